@@ -0,0 +1,179 @@
+/* cameraControlv5 -
+This program controls the camera for the aerial imaging platform,
+ gets a char over the serial connection and determines which command is sent, 
+ takes pictures, sets multishoot mode, sets autofocus and
+ sends reset signal to the Mega, if needed
+ By Michael Carlson (mic2169853@maricopa.edu) 
+ 08/07/2013
+ 
+ 11/13/2013
+ 
+ v5: multishoot spaces pictures by ground distance instead of time, so
+ forward overlap stays at MS_OVERLAP whatever the speed and altitude
+ (see multishoot.h)
+ */
+ 
+#define CAMERA 5
+#define MEGA 4
+#define AUTOFOCUS 3
+//#define DEBUG
+#include <GPS_UBLOX.h>
+#include "SoftwareSerial.h"
+#include "multishoot.h"
+
+//lens focal length and the sensor dimension along the direction of
+//travel, mm
+#define FOCAL_LENGTH 35.0
+#define SENSOR_ALONG 24.0
+
+
+char command;
+boolean multishoot;
+long lastPicTime;
+long currTime;
+msched sched;
+boolean haveGround;
+
+//setup: set output pins, start serial connection and initialize variables
+void setup()
+{
+  pinMode(CAMERA, OUTPUT);
+  pinMode(MEGA, OUTPUT);
+  pinMode(AUTOFOCUS, OUTPUT);
+  Serial.begin(57600);
+  multishoot = false;
+  lastPicTime = 0;
+  msInit(&sched, FOCAL_LENGTH, SENSOR_ALONG, 0);
+  haveGround = false;
+  
+  Serial.begin(57600);
+  Serial.println("GPS UBLOX library test");
+  GPS.Init();   // GPS Initialization
+  delay(1000);
+}//end setup()
+
+void loop()
+{
+  GPS.Read();
+  //the ground is where the first fix was, until 'g' says otherwise
+  if(GPS.Fix && !haveGround)
+  {
+    sched.groundAlt = GPS.Altitude/100.0;
+    haveGround = true;
+  }
+  //takePicture();
+  //if there is a value in the serial buffer
+  if(Serial.available() > 0)
+  {
+    command = Serial.read();
+  //commands: 't' = take picture, 'm' = multishoot mode on
+  //'l' = multishoot mode off, 'r'=reset the Mega
+  // 'c' = turn on autofocuss, 'j' = turn off autofocus
+  // 'g' = take the current altitude as ground level
+  switch(command)
+  {
+    case 't':
+      takePicture();
+      break;
+      
+    case 'm':
+      multishoot = true;
+      break;
+      
+    case 'l':
+      multishoot = false;
+      break;
+    
+    case 'r':
+      digitalWrite(MEGA, LOW);
+      delay(250);
+      digitalWrite(MEGA, HIGH);
+      break;
+      
+    case 'c':
+      digitalWrite(AUTOFOCUS, HIGH);
+      break;
+      
+    case 'j':
+      digitalWrite(AUTOFOCUS, LOW);
+      break;
+      
+    case 'g':
+      sched.groundAlt = GPS.Altitude/100.0;
+      haveGround = true;
+      break;
+      
+    default:
+      Serial.write(command);
+      break;
+      }//end switch(command)
+  }//end if(Serial.available() > 0)
+  //set command to null to keep the command from repeating
+  command = NULL;
+  //get the time for multishoot mode
+  currTime = millis();
+  #ifdef DEBUG
+  Serial.print("currTime is ");
+  Serial.println(currTime, DEC);
+  #endif
+  //track the ground covered since the last picture whether or not
+  //multishoot is on; without a fix or a usable height the scheduler
+  //falls back to a fixed interval
+  boolean due = msUpdate(&sched, currTime, GPS.Fix, GPS.Ground_Speed/100.0,
+                         GPS.Altitude/100.0);
+  //if multishoot is enabled
+  if(multishoot)
+  {
+    #ifdef DEBUG
+    Serial.println("In multihsoot");
+    Serial.print("Before TC, lastPicTime is ");
+    Serial.println(lastPicTime, DEC);
+    #endif
+    //take a picture once the platform has moved far enough for the
+    //target overlap
+    if(due)
+   {
+     takePicture();
+     #ifdef DEBUG
+     Serial.print("After taking pic, lastPicTime is ");
+     Serial.println(lastPicTime, DEC);
+     #endif
+   } //end if(due)
+    
+  }//end if(multishoot)
+  
+}//end loop
+
+//void takePicture() sends signal to camera to take a picture
+void takePicture() 
+{
+  #ifdef DEBUG
+  Serial.println("in takePicture()");
+  #endif
+  //delay(500);
+  digitalWrite(CAMERA, HIGH);
+  delay(250);//delayMicroseconds(1000);
+  digitalWrite(CAMERA, LOW);
+  lastPicTime = millis();
+  msShot(&sched, lastPicTime, GPS.Altitude/100.0);
+  
+    Serial.print("GPS:");
+    Serial.print(" Time:");
+    Serial.print(GPS.Time);
+    Serial.print(" Fix:");
+    Serial.print((int)GPS.Fix);
+    Serial.print(" Lat:");
+    Serial.print(GPS.Lattitude);
+    Serial.print(" Lon:");
+    Serial.print(GPS.Longitude);
+    Serial.print(" Alt:");
+    Serial.print(GPS.Altitude/1000.0);
+    Serial.print(" Speed:");
+    Serial.print(GPS.Ground_Speed/100.0);
+    Serial.print(" Course:");
+    Serial.print(GPS.Ground_Course/100000.0);
+    Serial.print(" Overlap:");
+    Serial.print(sched.achieved);
+    Serial.println();
+
+}//end takePicture()
@@ -0,0 +1,117 @@
+#ifndef MULTISHOOT_h
+#define MULTISHOOT_h
+
+/* multishoot.h -
+ Adaptive multishoot scheduling for the camera board. Instead of a picture
+ every 2 seconds, a picture is taken each time the platform has moved far
+ enough over the ground for the next frame to overlap the last one by the
+ target amount, which is the same as recomputing the trigger interval
+ (footprint * (1 - overlap) / ground speed) on every pass through loop().
+
+ Plain C, so the host simulation (groundstation/mssim.c) runs exactly the
+ code the board does.
+ */
+
+#include <math.h>
+
+//Limits and defaults for the scheduler, all times in ms
+#define MS_MIN_INTERVAL 1000   //fastest the camera can take and store frames
+#define MS_MAX_INTERVAL 30000  //take a frame at least this often, even hovering
+#define MS_OVERLAP 60.0        //default target forward overlap, percent
+#define MS_MIN_HEIGHT 2.0      //below this (m) the fallback interval applies
+//with no fix or no usable height, cameraControlv4's fixed interval
+#define MS_FALLBACK_INTERVAL 2000
+
+typedef struct msched {
+  //lens and sensor, same units for both (see fov() in panorama/gigapan.h)
+  float focal;
+  float sensor;          //sensor dimension along the direction of travel
+  float overlap;         //target forward overlap, percent
+  long minInterval;
+  long maxInterval;
+  long fallbackInterval;
+
+  //state
+  float groundAlt;       //altitude of the ground, m
+  float dist;            //ground distance covered since the last frame, m
+  float achieved;        //forward overlap achieved by the last frame, percent
+  float shotAlt;         //altitude of the last frame, m (NAN before the first)
+  long lastShot;
+  long lastUpdate;
+} msched;
+
+//msFov: field of view in degrees for a focal length and sensor dimension,
+//the formula fov() in panorama/gigapan.h uses
+float msFov(float f, float d)
+{
+  return 2.0*atan(0.5*d/f)*180.0/M_PI;
+}
+
+//msFootprint: length of ground one frame covers along the direction of
+//travel, looking straight down from height m above the ground
+float msFootprint(msched* s, float height)
+{
+  if(height < 0.0) height = 0.0;
+  return 2.0*height*tan(0.5*msFov(s->focal, s->sensor)*M_PI/180.0);
+}
+
+//msInit: sets up a scheduler with the defaults
+void msInit(msched* s, float focal, float sensor, long now)
+{
+  s->focal = focal;
+  s->sensor = sensor;
+  s->overlap = MS_OVERLAP;
+  s->minInterval = MS_MIN_INTERVAL;
+  s->maxInterval = MS_MAX_INTERVAL;
+  s->fallbackInterval = MS_FALLBACK_INTERVAL;
+  s->groundAlt = 0.0;
+  s->dist = 0.0;
+  s->achieved = 100.0;
+  s->shotAlt = NAN;
+  s->lastShot = now;
+  s->lastUpdate = now;
+}
+
+//msSpacing: ground distance, m, between frames that overlap by the target
+//at height m. 0 when too low for the footprint to mean anything.
+float msSpacing(msched* s, float height)
+{
+  if(height < MS_MIN_HEIGHT) return 0.0;
+  return msFootprint(s, height)*(1.0 - 0.01*s->overlap);
+}
+
+//msUpdate: call on every pass through loop() with the time, whether the
+//GPS has a fix, ground speed (m/s) and altitude (m). Returns 1 when a
+//frame is due. The spacing is worked out at the lower of here and the
+//last frame, since the smaller footprint is what limits the overlap while
+//climbing or descending. Without a fix, or too low over the ground for a
+//spacing (including when the ground reference is wrong), frames come
+//every fallbackInterval ms like they did before there was a scheduler.
+int msUpdate(msched* s, long now, int fix, float speed, float alt)
+{
+  if(!fix || speed < 0.0) speed = 0.0;
+  s->dist += speed*(now - s->lastUpdate)/1000.0;
+  s->lastUpdate = now;
+
+  long since = now - s->lastShot;
+  if(since < s->minInterval) return 0;
+  if(since >= s->maxInterval) return 1;
+
+  float spacing = fix ? msSpacing(s, fmin(alt, s->shotAlt) - s->groundAlt)
+                      : 0.0;
+  if(spacing <= 0.0) return since >= s->fallbackInterval;
+  return s->dist >= spacing;
+}
+
+//msShot: call whenever a frame is taken (multishoot or not), with the
+//altitude (m). Works out the overlap it achieved with the frame before.
+void msShot(msched* s, long now, float alt)
+{
+  float footprint = msFootprint(s, fmin(alt, s->shotAlt) - s->groundAlt);
+  s->achieved = footprint > 0.0 ? 100.0*(1.0 - s->dist/footprint) : 0.0;
+  s->shotAlt = alt;
+  s->dist = 0.0;
+  s->lastShot = now;
+}
+
+#endif
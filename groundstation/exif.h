@@ -0,0 +1,439 @@
+#ifndef SACPEXIF
+#define SACPEXIF
+
+/**********************************************
+ * UCSD E4E Stabilized Aerial Camera Platform *
+ * Ground Station                             *
+ *                                            *
+ * File: UCSD-E4E/sacp/groundstation/exif.h   *
+ * Requires ./sacplog.h                       *
+ *                                            *
+ * Compatibility: C99, Linux (_GNU_SOURCE)    *
+ **********************************************/
+
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include "sacplog.h"
+
+/***************JPEG segment scanning and EXIF GPS tagging****************
+ *
+ * Only the segments in front of the image data are ever looked at. The
+ * Exif APP1 segment is rebuilt in memory and everything else in the file
+ * is copied byte for byte (kernel side, with copy_file_range), so the
+ * compressed image is never decoded or even read into user space.
+ */
+
+/* Largest APP1 payload a JPEG segment can hold (16 bit length - itself) */
+#define APP1_MAX 65533
+
+/* Largest whole APP1 segment: marker, length and payload */
+#define APP1_SEG ( APP1_MAX + 4 )
+
+/* GPS minus UTC, in seconds. Only used for the EXIF GPSTimeStamp. */
+#define GPS_UTC_LEAP 18
+
+/* Tags we need to find or write */
+#define TAG_DATETIME      0x0132
+#define TAG_EXIF_IFD      0x8769
+#define TAG_GPS_IFD       0x8825
+#define TAG_DATETIME_ORIG 0x9003
+
+/* TIFF field types */
+#define T_BYTE     1
+#define T_ASCII    2
+#define T_SHORT    3
+#define T_LONG     4
+#define T_RATIONAL 5
+
+/* struct describing where things are in a JPEG's header segments */
+typedef struct jpeginfo {
+  off_t size;       /* whole file size */
+  off_t insert;     /* where the Exif APP1 starts, or should be inserted */
+  off_t resume;     /* where copying resumes after the Exif APP1 */
+  long  tifflen;    /* length of TIFF block in tiff[], 0 if no Exif */
+  unsigned char tiff[APP1_MAX];  /* old TIFF block (after "Exif\0\0") */
+} jpeginfo;
+
+
+/* Byte order aware accessors. le = 1 for "II" (Intel), 0 for "MM". */
+unsigned get16( const unsigned char* b, int le ) {
+  return le ? ( b[0] | b[1] << 8 ) : ( b[0] << 8 | b[1] );
+}
+
+unsigned long get32( const unsigned char* b, int le ) {
+  unsigned long lo = get16( le ? b : b+2, le ), hi = get16( le ? b+2 : b, le );
+  return hi << 16 | lo;
+}
+
+void put16( unsigned char* b, unsigned v, int le ) {
+  if( le ) { b[0] = v & 0xff; b[1] = v >> 8 & 0xff; }
+  else     { b[0] = v >> 8 & 0xff; b[1] = v & 0xff; }
+}
+
+void put32( unsigned char* b, unsigned long v, int le ) {
+  if( le ) { put16( b, v & 0xffff, 1 ); put16( b+2, v >> 16 & 0xffff, 1 ); }
+  else     { put16( b, v >> 16 & 0xffff, 0 ); put16( b+2, v & 0xffff, 0 ); }
+}
+
+
+/* int jpegScan( open jpeg, info to fill in )
+ *
+ * Walks the marker segments from SOI up to the first one that isn't APPn,
+ * noting the Exif APP1 if there is one. Without one, the insertion point is
+ * right after SOI, or after a JFIF APP0 if that comes first.
+ *
+ * Returns 0 on success, -1 if this doesn't look like a JPEG.
+ */
+int jpegScan( int fd, jpeginfo* info ) {
+  unsigned char hdr[10];
+  struct stat st;
+  off_t pos = 2;
+
+  if( fstat( fd, &st ) || st.st_size < 4 ) return -1;
+  info->size = st.st_size;
+  info->tifflen = 0;
+
+  if( pread( fd, hdr, 2, 0 ) != 2 || hdr[0] != 0xff || hdr[1] != 0xd8 )
+    return -1;
+
+  info->insert = info->resume = 2;
+
+  while( pos + 4 <= info->size ) {
+    if( pread( fd, hdr, 10, pos ) < 4 || hdr[0] != 0xff ) return -1;
+
+    /* only APP0..APP15 come before the Exif block in practice */
+    if( hdr[1] < 0xe0 || 0xef < hdr[1] ) break;
+
+    long seglen = get16( hdr+2, 0 );
+    if( seglen < 2 || info->size < pos + 2 + seglen ) return -1;
+
+    if( hdr[1] == 0xe1 && 8 <= seglen && !memcmp( hdr+4, "Exif\0\0", 6 ) ) {
+      info->tifflen = seglen - 8;
+      if( pread( fd, info->tiff, info->tifflen, pos + 10 ) != info->tifflen )
+        return -1;
+      info->insert = pos;
+      info->resume = pos + 2 + seglen;
+      return 0;
+    }
+
+    /* keep JFIF first, as viewers expect */
+    if( hdr[1] == 0xe0 && pos == 2 )
+      info->insert = info->resume = pos + 2 + seglen;
+
+    pos += 2 + seglen;
+  }
+
+  return 0;
+}
+
+/* int tiffFindTag( tiff block, length, little endian?, IFD offset, tag )
+ *
+ * Returns the offset of the 12 byte directory entry for tag in the IFD at
+ * the given offset, or -1 if the IFD is malformed or doesn't have it.
+ */
+long tiffFindTag( const unsigned char* t, long len, int le,
+                  unsigned long ifd, unsigned tag ) {
+  if( len < 2 || (unsigned long)len - 2 < ifd ) return -1;
+
+  unsigned n = get16( t+ifd, le );
+  if( (unsigned long)len < ifd + 2 + 12*(unsigned long)n ) return -1;
+
+  unsigned i;
+  for( i = 0; i < n; ++i ) {
+    long e = ifd + 2 + 12*i;
+    if( get16( t+e, le ) == tag ) return e;
+  }
+  return -1;
+}
+
+/* int exifDateTime( jpeg info, output "YYYY:MM:DD HH:MM:SS" buffer )
+ *
+ * Pulls DateTimeOriginal out of the Exif IFD, falling back to IFD0's
+ * DateTime for cameras that only fill that one in.
+ *
+ * Returns 0 if a timestamp was found, -1 otherwise.
+ */
+int exifDateTime( const jpeginfo* info, char out[20] ) {
+  const unsigned char* t = info->tiff;
+  long len = info->tifflen;
+
+  if( len < 8 ) return -1;
+  int le = t[0] == 'I';
+  unsigned long ifd0 = get32( t+4, le );
+
+  long e = -1;
+  long sub = tiffFindTag( t, len, le, ifd0, TAG_EXIF_IFD );
+  if( 0 <= sub ) e = tiffFindTag( t, len, le, get32( t+sub+8, le ),
+                                  TAG_DATETIME_ORIG );
+  if( e < 0 ) e = tiffFindTag( t, len, le, ifd0, TAG_DATETIME );
+  if( e < 0 || get16( t+e+2, le ) != T_ASCII || get32( t+e+4, le ) < 20 )
+    return -1;
+
+  unsigned long off = get32( t+e+8, le );
+  if( (unsigned long)len < off + 20 ) return -1;
+
+  memcpy( out, t+off, 19 );
+  out[19] = '\0';
+  return 0;
+}
+
+
+/* unsigned char* putEntry( entry pointer, tag, type, count, value, le )
+ *
+ * Writes one 12 byte IFD entry whose value field is a 32 bit number
+ * (an offset, or a LONG). Returns the pointer to the next entry.
+ */
+unsigned char* putEntry( unsigned char* e, unsigned tag, unsigned type,
+                         unsigned long count, unsigned long val, int le ) {
+  put16( e, tag, le ); put16( e+2, type, le );
+  put32( e+4, count, le ); put32( e+8, val, le );
+  return e + 12;
+}
+
+/* Same as putEntry, for up to 4 bytes of BYTE/ASCII data stored inline */
+unsigned char* putInline( unsigned char* e, unsigned tag, unsigned type,
+                          unsigned long count, const char* bytes, int le ) {
+  put16( e, tag, le ); put16( e+2, type, le ); put32( e+4, count, le );
+  memset( e+8, 0, 4 ); memcpy( e+8, bytes, count );
+  return e + 12;
+}
+
+/* Writes a rational num/den at r, returns pointer past it */
+unsigned char* putRational( unsigned char* r, double v, unsigned long den,
+                            int le ) {
+  put32( r, (unsigned long)( v*den + 0.5 ), le ); put32( r+4, den, le );
+  return r + 8;
+}
+
+/* Writes degrees * 1e7 as the 3 rational degrees, minutes, seconds */
+unsigned char* putDMS( unsigned char* r, long e7, int le ) {
+  double a = labs( e7 )/1e7;
+  double d = floor( a ), m = floor( 60.0*( a - d ) );
+  double s = 3600.0*( a - d ) - 60.0*m;
+  r = putRational( r, d, 1, le );
+  r = putRational( r, m, 1, le );
+  return putRational( r, s, 10000, le );
+}
+
+/* Number of entries and rationals in the GPS IFD exifGps() writes, and
+ * its size in all */
+#define GPS_ENTRIES 12
+#define GPS_RATIONALS 12
+#define GPS_SIZE ( 2 + 12*GPS_ENTRIES + 4 + 8*GPS_RATIONALS )
+
+/* long exifGps( output buffer, offset of GPS IFD in TIFF block, fix, le )
+ *
+ * Writes a complete GPS IFD (entries, next-IFD link, then its rational
+ * data) for the fix at out, which sits at TIFF offset base.
+ *
+ * Returns the number of bytes written.
+ */
+long exifGps( unsigned char* out, unsigned long base, const gpsfix* fix,
+              int le ) {
+  unsigned long data = base + 2 + 12*GPS_ENTRIES + 4;
+  unsigned char* e = out + 2;
+  unsigned char* r = out + ( data - base );
+
+  /* GPS time of day, corrected to UTC */
+  long tod = ( fix->time/1000 - GPS_UTC_LEAP + 86400 ) % 86400;
+  double sec = tod % 60 + ( fix->time % 1000 )/1000.0;
+
+  put16( out, GPS_ENTRIES, le );
+
+  e = putInline( e, 0x0000, T_BYTE, 4, "\2\3\0\0", le );
+  e = putInline( e, 0x0001, T_ASCII, 2, fix->lat < 0 ? "S" : "N", le );
+  e = putEntry( e, 0x0002, T_RATIONAL, 3, data, le );
+  r = putDMS( r, fix->lat, le );
+  e = putInline( e, 0x0003, T_ASCII, 2, fix->lon < 0 ? "W" : "E", le );
+  e = putEntry( e, 0x0004, T_RATIONAL, 3, data + 24, le );
+  r = putDMS( r, fix->lon, le );
+  e = putInline( e, 0x0005, T_BYTE, 1, fix->alt < 0 ? "\1" : "\0", le );
+  e = putEntry( e, 0x0006, T_RATIONAL, 1, data + 48, le );
+  r = putRational( r, fabs( fix->alt ), 100, le );
+  e = putEntry( e, 0x0007, T_RATIONAL, 3, data + 56, le );
+  r = putRational( r, tod/3600, 1, le );
+  r = putRational( r, tod/60 % 60, 1, le );
+  r = putRational( r, sec, 1000, le );
+  e = putInline( e, 0x000c, T_ASCII, 2, "K", le );
+  e = putEntry( e, 0x000d, T_RATIONAL, 1, data + 80, le );
+  r = putRational( r, 3.6*fix->speed, 100, le );
+  e = putInline( e, 0x000e, T_ASCII, 2, "T", le );
+  e = putEntry( e, 0x000f, T_RATIONAL, 1, data + 88, le );
+  r = putRational( r, fix->course, 100, le );
+
+  /* no next IFD */
+  put32( e, 0, le );
+
+  return r - out;
+}
+
+/* long exifBuild( jpeg info, fix, output APP1 segment buffer )
+ *
+ * Builds the complete replacement APP1 segment (marker and length included,
+ * at most APP1_SEG bytes) carrying the fix. An existing TIFF block is kept
+ * as is; a new copy of IFD0 pointing at a new GPS IFD is appended and the
+ * header is pointed at it, so every offset already in the block (Exif IFD,
+ * MakerNote, thumbnail) stays valid. If the block ends with an IFD0 and
+ * GPS IFD laid out the way this writes them (an image tagged before), the
+ * new ones are written over them instead, so tagging again doesn't grow
+ * the file. Without an existing block a minimal one is made.
+ *
+ * Returns the segment length, or -1 if the old block is malformed or the
+ * result wouldn't fit in a segment.
+ */
+long exifBuild( const jpeginfo* info, const gpsfix* fix, unsigned char* out ) {
+  unsigned char* t = out + 10;
+  const unsigned char* old = info->tiff;
+  long len;
+  int le;
+
+  memcpy( out, "\xff\xe1\0\0Exif\0\0", 10 );
+
+  if( info->tifflen ) {
+    if( info->tifflen < 8 ) return -1;
+    le = old[0] == 'I';
+    unsigned long ifd0 = get32( old+4, le );
+    if( (unsigned long)info->tifflen < ifd0 + 2 ) return -1;
+
+    unsigned n = get16( old+ifd0, le );
+    unsigned long end = ifd0 + 2 + 12*(unsigned long)n;
+    if( (unsigned long)info->tifflen < end + 4 ) return -1;
+
+    /* new IFD0 goes after the old block, word aligned, or over our own
+     * IFD0 and GPS IFD if they end it */
+    unsigned long base = info->tifflen;
+    long g = tiffFindTag( old, info->tifflen, le, ifd0, TAG_GPS_IFD );
+    if( 0 <= g && 8 <= ifd0 && get32( old+g+8, le ) == end + 4 &&
+        end + 4 + GPS_SIZE == (unsigned long)info->tifflen &&
+        get16( old+end+4, le ) == GPS_ENTRIES )
+      base = ifd0;
+
+    /* the GPS pointer is new unless there was one to drop */
+    len = ( base + 1 ) & ~1L;
+    if( APP1_MAX - 6 < len + 2 + 12*( n + ( g < 0 ) ) + 4 + GPS_SIZE )
+      return -1;
+
+    memcpy( t, old, base );
+    t[base] = 0;
+    put32( t+4, len, le );
+
+    /* copy entries in tag order, dropping any old GPS pointer */
+    unsigned char* e = t + len + 2;
+    unsigned long gps = 0;
+    unsigned i, m = 0;
+    int placed = 0;
+    for( i = 0; i < n; ++i ) {
+      const unsigned char* oe = old + ifd0 + 2 + 12*i;
+      unsigned tag = get16( oe, le );
+      if( tag == TAG_GPS_IFD ) continue;
+      if( !placed && TAG_GPS_IFD < tag ) {
+        gps = e - t; e += 12; ++m; placed = 1;
+      }
+      memcpy( e, oe, 12 ); e += 12; ++m;
+    }
+    if( !placed ) { gps = e - t; e += 12; ++m; }
+
+    put16( t+len, m, le );
+    memcpy( e, old+end, 4 );  /* IFD1 (thumbnail) link stays */
+    e += 4;
+
+    putEntry( t+gps, TAG_GPS_IFD, T_LONG, 1, e - t, le );
+    len = ( e - t ) + exifGps( e, e - t, fix, le );
+  }
+
+  else {
+    le = 1;
+    memcpy( t, "II*\0", 4 );
+    put32( t+4, 8, le );
+    put16( t+8, 1, le );
+    putEntry( t+10, TAG_GPS_IFD, T_LONG, 1, 26, le );
+    put32( t+22, 0, le );
+    len = 26 + exifGps( t+26, 26, fix, le );
+  }
+
+  put16( out+2, len + 8, 0 );
+  return len + 10;
+}
+
+
+/* int copyRange( source fd, offset, length, destination fd )
+ *
+ * Copies bytes between files without bringing them into user space when
+ * the kernel allows it, otherwise through a small bounce buffer.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+int copyRange( int in, off_t off, off_t len, int out ) {
+  while( 0 < len ) {
+    ssize_t n = copy_file_range( in, &off, out, NULL, len, 0 );
+    if( n < 0 && ( errno == EXDEV || errno == ENOSYS || errno == EINVAL ||
+                   errno == EOPNOTSUPP ) )
+      break;
+    if( n <= 0 ) return -1;
+    len -= n;
+  }
+
+  char buf[65536];
+  while( 0 < len ) {
+    ssize_t n = pread( in, buf, len < (off_t)sizeof(buf) ? len : sizeof(buf),
+                       off );
+    if( n <= 0 || write( out, buf, n ) != n ) return -1;
+    off += n; len -= n;
+  }
+  return 0;
+}
+
+/* int jpegGeotag( path to jpeg, scratch jpeg info, fix to write,
+ *                 scratch segment buffer )
+ *
+ * Writes the fix into the JPEG's EXIF in place: the new file is streamed
+ * into a temporary next to the original (header bytes, new APP1, then the
+ * untouched remainder) and renamed over it, so a crash never leaves a
+ * half-written image behind. The scratch buffer must hold APP1_SEG.
+ *
+ * Returns 0 on success, -1 on error (errno is left as the cause).
+ */
+int jpegGeotag( const char* path, jpeginfo* info, const gpsfix* fix,
+                unsigned char* seg ) {
+  char tmp[4096];
+  struct stat st;
+  int in, out;
+
+  if( snprintf( tmp, sizeof(tmp), "%s.geotag", path ) >= (int)sizeof(tmp) ) {
+    errno = ENAMETOOLONG; return -1;
+  }
+
+  in = open( path, O_RDONLY );
+  if( in < 0 ) return -1;
+
+  long seglen;
+  if( fstat( in, &st ) || jpegScan( in, info ) ||
+      ( seglen = exifBuild( info, fix, seg ) ) < 0 ) {
+    close( in ); errno = EINVAL; return -1;
+  }
+
+  out = open( tmp, O_WRONLY | O_CREAT | O_TRUNC, st.st_mode & 07777 );
+  if( out < 0 ) { close( in ); return -1; }
+
+  int bad = copyRange( in, 0, info->insert, out ) ||
+            write( out, seg, seglen ) != seglen ||
+            copyRange( in, info->resume, info->size - info->resume, out );
+  bad = close( out ) || bad;
+  if( bad || rename( tmp, path ) ) {
+    int err = errno;
+    unlink( tmp ); close( in );
+    errno = err;
+    return -1;
+  }
+
+  close( in );
+  return 0;
+}
+
+#endif /* SACPEXIF */
@@ -0,0 +1,146 @@
+/**********************************************
+ * UCSD E4E Stabilized Aerial Camera Platform *
+ * EXIF GPS Tagging Checks                    *
+ *                                            *
+ * File: UCSD-E4E/sacp/groundstation/         *
+ *   exiftest.c                               *
+ * Requires ./exif.h ./sacplog.h              *
+ **********************************************/
+
+#include <stdlib.h>
+#include "exif.h"
+
+/* Checks jpegGeotag() on made up JPEGs in a temporary directory: an Exif
+ * block as big as a segment allows, and tagging the same file twice. Run
+ * by "make check"; prints one line per check and exits nonzero if any
+ * failed. Build with -fsanitize=address to have overruns caught too. */
+
+/* Bytes of made up image data after the header segments */
+#define SCAN_BYTES 1000
+
+int failed = 0;
+
+void check( int ok, const char* what ) {
+  printf( "%s %s\n", ok ? "ok  " : "FAIL", what );
+  failed += !ok;
+}
+
+/* off_t fileSize( path ) - size of a file, or -1 */
+off_t fileSize( const char* path ) {
+  struct stat st;
+  return stat( path, &st ) ? -1 : st.st_size;
+}
+
+/* int writeJpeg( path, TIFF block length )
+ *
+ * A JPEG with a JFIF APP0, then (for a nonzero length) an Exif APP1 whose
+ * TIFF block is that long: an IFD0 holding only DateTime, its string, and
+ * zeros, then a scan. Returns 0 or -1.
+ */
+int writeJpeg( const char* path, long tifflen ) {
+  static unsigned char b[APP1_SEG + 64 + SCAN_BYTES];
+  static const unsigned char jfif[] = { 0xff, 0xd8, 0xff, 0xe0, 0, 16, 'J',
+    'F', 'I', 'F', 0, 1, 1, 0, 0, 1, 0, 1, 0, 0 };
+  long n = sizeof(jfif);
+
+  memcpy( b, jfif, n );
+  if( tifflen ) {
+    unsigned char* t = b + n + 10;
+    memcpy( b + n, "\xff\xe1\0\0Exif\0\0", 10 );
+    put16( b + n + 2, tifflen + 8, 0 );
+    memset( t, 0, tifflen );
+    memcpy( t, "II*\0", 4 );
+    put32( t+4, 8, 1 );
+    put16( t+8, 1, 1 );
+    putEntry( t+10, TAG_DATETIME, T_ASCII, 20, 26, 1 );
+    put32( t+22, 0, 1 );
+    memcpy( t+26, "2026:10:19 12:34:56", 20 );
+    n += 10 + tifflen;
+  }
+  b[n++] = 0xff; b[n++] = 0xda;
+  memset( b + n, 0x55, SCAN_BYTES ); n += SCAN_BYTES;
+  b[n++] = 0xff; b[n++] = 0xd9;
+
+  FILE* f = fopen( path, "wb" );
+  if( !f ) return -1;
+  int bad = fwrite( b, 1, n, f ) != (size_t)n;
+  return fclose( f ) || bad ? -1 : 0;
+}
+
+/* int tagged( path, jpeg info, fix, had a DateTime? )
+ *
+ * Whether the file is a JPEG whose Exif carries the fix's latitude in its
+ * GPS IFD and still has the DateTime the test image started with, if any.
+ */
+int tagged( const char* path, jpeginfo* info, const gpsfix* fix,
+            int stamped ) {
+  int fd = open( path, O_RDONLY );
+  char stamp[20];
+
+  if( fd < 0 ) return 0;
+  int ok = !jpegScan( fd, info ) && info->tifflen &&
+           ( !stamped || ( !exifDateTime( info, stamp ) &&
+                           !strcmp( stamp, "2026:10:19 12:34:56" ) ) );
+  close( fd );
+  if( !ok ) return 0;
+
+  const unsigned char* t = info->tiff;
+  int le = t[0] == 'I';
+  long e = tiffFindTag( t, info->tifflen, le, get32( t+4, le ), TAG_GPS_IFD );
+  if( e < 0 ) return 0;
+  unsigned long gps = get32( t+e+8, le );
+  long lat = tiffFindTag( t, info->tifflen, le, gps, 0x0002 );
+  if( lat < 0 ) return 0;
+  unsigned long r = get32( t+lat+8, le );
+  if( (unsigned long)info->tifflen < r + 8 ) return 0;
+  return get32( t+r, le ) == (unsigned long)( labs( fix->lat )/10000000 );
+}
+
+
+int main() {
+  char dir[] = "/tmp/exiftestXXXXXX", path[64], msg[128];
+  jpeginfo* info = (jpeginfo*)malloc( sizeof(jpeginfo) );
+  /* exactly as big as jpegGeotag() is documented to need */
+  unsigned char* seg = (unsigned char*)malloc( APP1_SEG );
+  gpsfix a = { 230418000, 1, 328812345, -1172345678, 120.5, 4.2, 88.0 };
+  gpsfix b = { 230420000, 1, 338812345, -1172345678, 121.5, 4.1, 87.0 };
+
+  if( !info || !seg || !mkdtemp( dir ) ) {
+    fprintf( stderr, "\nCould not set up the test\n" );
+    return -1;
+  }
+  snprintf( path, sizeof(path), "%s/test.jpg", dir );
+
+  /* the biggest old block whose tagged copy still fits (the new IFD0 is
+   * word aligned, so the segment comes to APP1_SEG - 1 bytes), and one
+   * byte more, which doesn't */
+  long most = ( APP1_MAX - 6 - ( 2 + 12*2 + 4 + GPS_SIZE ) ) & ~1L;
+  check( !writeJpeg( path, most ) && !jpegGeotag( path, info, &a, seg ) &&
+         tagged( path, info, &a, 1 ) &&
+         fileSize( path ) == 20 + APP1_SEG - 1 + 4 + SCAN_BYTES,
+         "Exif block at the segment size limit is tagged" );
+  check( !writeJpeg( path, most + 1 ) && jpegGeotag( path, info, &a, seg ) &&
+         errno == EINVAL, "Exif block one byte over the limit is refused" );
+
+  /* tagging again writes over the old tags rather than adding more */
+  long lens[] = { 0, 100, 101, 4000, most };
+  int i;
+  for( i = 0; i < (int)( sizeof(lens)/sizeof(lens[0]) ); ++i ) {
+    int ok = !writeJpeg( path, lens[i] ) && !jpegGeotag( path, info, &a, seg );
+    off_t once = fileSize( path );
+    ok = ok && !jpegGeotag( path, info, &b, seg ) &&
+         tagged( path, info, &b, lens[i] ) && fileSize( path ) == once &&
+         !jpegGeotag( path, info, &a, seg ) &&
+         tagged( path, info, &a, lens[i] ) && fileSize( path ) == once;
+    snprintf( msg, sizeof(msg), "tagging three times keeps the size "
+              "(%ld byte TIFF block)", lens[i] );
+    check( ok, msg );
+  }
+
+  unlink( path );
+  rmdir( dir );
+  free( info ); free( seg );
+
+  if( failed ) fprintf( stderr, "\n%d checks failed\n", failed );
+  return failed ? -1 : 0;
+}
@@ -0,0 +1,344 @@
+/**********************************************
+ * UCSD E4E Stabilized Aerial Camera Platform *
+ * Firmware Simulator                         *
+ *                                            *
+ * File: UCSD-E4E/sacp/groundstation/fwsim.c  *
+ * Requires ./ring.h ./sacplog.h              *
+ *   ../Arduino/cameraControlv5/multishoot.h  *
+ **********************************************/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include "ring.h"
+#include "sacplog.h"
+#include "../Arduino/cameraControlv5/multishoot.h"
+
+/* Stand-ins for the stabilization Mega and the camera board on a pair of
+ * pseudo-terminals, so gsd (or anything else) can be run and load tested
+ * without hardware. Each board's output is paced to the baud rate like a
+ * real UART, and can be corrupted and cut off on purpose. */
+
+#define DEF_BAUD 57600
+
+/* Pacing tick, and how many bytes a UART can burst (its FIFO) */
+#define TICK_NS 1000000
+#define FIFO 64
+
+/* Sim output backlog per board */
+#define OUT_SIZE 16384
+
+/* Camera board lens and sensor along the track, mm (cameraControlv5) */
+#define FOCAL_LENGTH 35.0
+#define SENSOR_ALONG 24.0
+
+/* Simulated flight: launched from GROUND_ALT, climbing to within 10 m of
+ * CRUISE_HEIGHT above it, at a speed that swings between 1 and 7 m/s */
+#define GROUND_ALT 120.0
+#define CRUISE_HEIGHT 40.0
+
+void usage() {
+  puts( "\nfwsim [-b baud] [-r hz] [-e error rate] [-d ms] [-D ms] [-t s]"   );
+  puts( "      [-s seed]\n"                                                  );
+  puts( "  Prints the Mega's and the camera board's pseudo-terminal paths,"  );
+  puts( "  then acts like both boards until killed."                         );
+  puts( "  -r   Mega attitude reports per second (default 50, 0 floods the" );
+  puts( "       link at full baud)"                                          );
+  puts( "  -e   probability of any one sent byte getting a bit flipped"      );
+  puts( "  -d   length of each dropout, in ms, during which nothing gets"    );
+  puts( "       through either way (default 0: none)"                        );
+  puts( "  -D   time between dropouts, in ms (default 10000)"                );
+  puts( "  -t   stop after this many seconds (default: run until killed)"    );
+  puts( "  -s   seed for the bit errors, so a run can be repeated (default 1)" );
+  printf( "  -b   baud rate (default: %d)\n", DEF_BAUD );
+}
+
+/* struct for one simulated board */
+typedef struct board {
+  const char* name;
+  int master, slave;       /* pty ends; slave is held open so it stays up */
+  ring out;                /* bytes waiting for the wire */
+  char cmd[64];            /* command being received */
+  size_t cmdlen;
+  unsigned long long sent, lost, corrupted;
+} board;
+
+board boards[NLINKS] = { { "mega" }, { "cam" } };
+
+/* simulated state */
+double yawCenter = 180.0, pitchCenter = 100.0;
+int stabilize = 0, multishoot = 0;
+long gpsTime = 230418000;   /* ms time of week */
+double lat = 32.8812345, lon = -117.2345678;
+double alt = GROUND_ALT, speed = 0.0, course = 45.0;
+msched sched;
+
+/* options */
+uint32_t baud = DEF_BAUD;
+double rate = 50.0, errRate = 0.0;
+long dropMs = 0, dropEvery = 10000;
+
+
+/* int ptyOpen( board )
+ *
+ * Makes a raw pseudo-terminal for the board. Returns 0 or -1.
+ */
+int ptyOpen( board* b ) {
+  struct termios tio;
+
+  b->master = posix_openpt( O_RDWR | O_NOCTTY | O_NONBLOCK );
+  if( b->master < 0 || grantpt( b->master ) || unlockpt( b->master ) )
+    return -1;
+
+  b->slave = open( ptsname( b->master ), O_RDWR | O_NOCTTY );
+  if( b->slave < 0 || tcgetattr( b->slave, &tio ) ) return -1;
+  cfmakeraw( &tio );
+  return tcsetattr( b->slave, TCSANOW, &tio ) ? -1 : 0;
+}
+
+/* void say( board, printf style ) - queues output for the board's UART */
+void say( board* b, const char* fmt, ... ) {
+  char line[256];
+  va_list ap;
+  va_start( ap, fmt );
+  int n = vsnprintf( line, sizeof(line), fmt, ap );
+  va_end( ap );
+  if( (int)sizeof(line) <= n ) n = sizeof(line) - 1;
+  if( ringPut( &b->out, line, n ) < (size_t)n ) ++b->lost;
+}
+
+/* void takePicture() - the camera board's shutter report */
+void takePicture() {
+  msShot( &sched, gpsTime, alt );
+  say( &boards[LINK_CAM], "GPS: Time:%ld Fix:1 Lat:%ld Lon:%ld Alt:%.2f "
+       "Speed:%.2f Course:%.2f Overlap:%.2f\r\n", gpsTime, lround( lat*1e7 ),
+       lround( lon*1e7 ), alt/ALT_PRINT_SCALE, speed,
+       course/COURSE_PRINT_SCALE, sched.achieved );
+}
+
+/* void megaReport() - a made up attitude report, wobbling about center */
+void megaReport( double t ) {
+  say( &boards[LINK_MEGA], " Roll = %.3f Pitch = %.3f Yaw = %.3f\r\n",
+       2.0*sin( 3.1*t ), pitchCenter - 90.0 + sin( 1.7*t ),
+       yawCenter + 3.0*sin( 0.9*t ) );
+}
+
+/* void megaCommand( command, with any number after it )
+ *
+ * What the Mega's loop() does with a command.
+ */
+void megaCommand( const char* cmd ) {
+  double arg = atof( cmd+1 );
+
+  switch( cmd[0] ) {
+    case 'd': yawCenter = fmod( yawCenter + 10.0, 360.0 ); break;
+    case 'a': yawCenter = fmod( yawCenter + 350.0, 360.0 ); break;
+    case 'y': if( -180.0 <= arg && arg <= 180.0 )
+                yawCenter = fmod( yawCenter + 360.0 + arg, 360.0 );
+              break;
+    case 'w': pitchCenter += 5.0; break;
+    case 's': pitchCenter -= 5.0; break;
+    case 'p': if( 80.0 <= arg && arg <= 120.0 ) pitchCenter = arg; break;
+    case 'q': stabilize = 1; break;
+    case 'z': stabilize = 0; break;
+  }
+}
+
+/* void received( board number, byte )
+ *
+ * Feeds one received byte to a board's command handling. The Mega's 'y'
+ * and 'p' take a number, which ends at the first byte that can't be part
+ * of it (like Serial.parseInt(), minus the timeout).
+ */
+void received( int l, char c ) {
+  board* b = &boards[l];
+
+  if( l == LINK_CAM ) {
+    switch( c ) {
+      case 't': takePicture(); break;
+      case 'm': multishoot = 1; break;
+      case 'l': multishoot = 0; break;
+      case 'g': sched.groundAlt = alt; break;
+      case 'r': case 'c': case 'j': break;
+      default: say( b, "%c", c ); break;
+    }
+    return;
+  }
+
+  if( b->cmdlen ) {
+    if( strchr( "0123456789.-", c ) && b->cmdlen < sizeof(b->cmd) - 1 ) {
+      b->cmd[b->cmdlen++] = c;
+      return;
+    }
+    b->cmd[b->cmdlen] = '\0';
+    megaCommand( b->cmd );
+    b->cmdlen = 0;
+  }
+
+  b->cmd[0] = c; b->cmd[1] = '\0';
+  if( c == 'y' || c == 'p' ) b->cmdlen = 1;
+  else megaCommand( b->cmd );
+}
+
+/* SIGINT/SIGTERM stop the simulation so the statistics get printed */
+volatile sig_atomic_t stop = 0;
+
+void onSignal( int sig ) {
+  stop = sig;
+}
+
+
+int main( int argc, char** argv ) {
+  double seconds = 0.0;
+  unsigned seed = 1;
+  int c, l;
+
+  while( ( c = getopt( argc, argv, "b:r:e:d:D:t:s:" ) ) != -1 ) {
+    switch( c ) {
+      case 'b': baud = atol( optarg ); break;
+      case 'r': rate = atof( optarg ); break;
+      case 'e': errRate = atof( optarg ); break;
+      case 'd': dropMs = atol( optarg ); break;
+      case 'D': dropEvery = atol( optarg ); break;
+      case 't': seconds = atof( optarg ); break;
+      case 's': seed = atol( optarg ); break;
+      default: usage(); return -1;
+    }
+  }
+
+  if( optind != argc || !baud || rate < 0.0 || errRate < 0.0 ||
+      dropMs < 0 || dropEvery <= dropMs ) {
+    usage();
+    return -1;
+  }
+  srand( seed );
+
+  int epfd = epoll_create1( 0 );
+  struct epoll_event ev;
+
+  for( l = 0; l < NLINKS; ++l ) {
+    if( ptyOpen( &boards[l] ) || ringInit( &boards[l].out, OUT_SIZE ) ) {
+      perror( "fwsim" );
+      return -1;
+    }
+    ev.events = EPOLLIN; ev.data.u32 = l;
+    epoll_ctl( epfd, EPOLL_CTL_ADD, boards[l].master, &ev );
+    printf( "%s: %s\n", boards[l].name, ptsname( boards[l].master ) );
+  }
+  fflush( stdout );
+
+  int timerfd = timerfd_create( CLOCK_MONOTONIC, TFD_NONBLOCK );
+  struct itimerspec its = { { 0, TICK_NS }, { 0, TICK_NS } };
+  timerfd_settime( timerfd, 0, &its, NULL );
+  ev.events = EPOLLIN; ev.data.u32 = NLINKS;
+  epoll_ctl( epfd, EPOLL_CTL_ADD, timerfd, &ev );
+  struct sigaction sa;
+  memset( &sa, 0, sizeof(sa) );
+  sa.sa_handler = onSignal;
+  sigaction( SIGINT, &sa, NULL ); sigaction( SIGTERM, &sa, NULL );
+
+  struct timespec t0;
+  clock_gettime( CLOCK_MONOTONIC, &t0 );
+  double budget[NLINKS] = { 0, 0 };
+  double lastTick = 0.0, nextReport = 0.0;
+  msInit( &sched, FOCAL_LENGTH, SENSOR_ALONG, gpsTime );
+  sched.groundAlt = GROUND_ALT;
+
+  while( !stop ) {
+    struct epoll_event evs[4];
+    int i, n = epoll_wait( epfd, evs, 4, -1 );
+
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    double t = ( ts.tv_sec - t0.tv_sec ) + ( ts.tv_nsec - t0.tv_nsec )*1e-9;
+    int down = dropMs && fmod( 1000.0*t, dropEvery ) < dropMs;
+
+    if( 0.0 < seconds && seconds < t ) break;
+
+    for( i = 0; i < n; ++i ) {
+      l = evs[i].data.u32;
+
+      /* commands from the ground station */
+      if( l < NLINKS ) {
+        char buf[256];
+        ssize_t got = read( boards[l].master, buf, sizeof(buf) ), j;
+        for( j = 0; !down && j < got; ++j ) received( l, buf[j] );
+        continue;
+      }
+
+      uint64_t ticks;
+      if( read( timerfd, &ticks, sizeof(ticks) ) < 0 ) continue;
+
+      /* the boards' own output */
+      gpsTime = ( 230418000 + (long)( 1000.0*t ) ) % MS_PER_WEEK;
+      speed = 4.0 - 3.0*cos( 0.05*t );
+      alt = GROUND_ALT + CRUISE_HEIGHT*( 1.0 - exp( -0.1*t ) ) +
+            10.0*sin( 0.02*t );
+      lat += speed*( t - lastTick )*cos( course*M_PI/180.0 )/111195.0;
+      lon += speed*( t - lastTick )*sin( course*M_PI/180.0 )/
+             ( 111195.0*cos( lat*M_PI/180.0 ) );
+
+      if( msUpdate( &sched, gpsTime, 1, speed, alt ) && multishoot )
+        takePicture();
+
+      if( 0.0 < rate ) {
+        while( nextReport <= t ) { megaReport( t ); nextReport += 1.0/rate; }
+      }
+      else {
+        while( 256 < ringSpace( &boards[LINK_MEGA].out ) ) megaReport( t );
+      }
+
+      /* pace each UART to the baud rate */
+      for( l = 0; l < NLINKS; ++l ) {
+        board* b = &boards[l];
+        struct iovec iov[2];
+        size_t k, len;
+
+        budget[l] += ( t - lastTick )*baud/BITS_PER_BYTE;
+        if( FIFO < budget[l] ) budget[l] = FIFO;
+        len = ringUsed( &b->out ) < budget[l] ? ringUsed( &b->out )
+                                              : (size_t)budget[l];
+        if( !len ) continue;
+        budget[l] -= len;
+
+        if( down ) {
+          ringConsume( &b->out, len );
+          b->lost += len;
+          continue;
+        }
+
+        for( k = 0; k < len; ++k ) {
+          if( errRate && rand() < errRate*RAND_MAX ) {
+            b->out.buf[( b->out.tail + k ) & ( b->out.size - 1 )] ^=
+              1 << rand() % 8;
+            ++b->corrupted;
+          }
+        }
+
+        int m = ringSpans( &b->out, 0, len, iov );
+        ssize_t put = writev( b->master, iov, m );
+        if( put < 0 ) put = 0;
+
+        /* a real UART doesn't wait for the other end either */
+        ringConsume( &b->out, len );
+        b->sent += put;
+        b->lost += len - put;
+      }
+      lastTick = t;
+    }
+  }
+
+  for( l = 0; l < NLINKS; ++l )
+    fprintf( stderr, "%s: %llu bytes sent, %llu lost, %llu corrupted\n",
+             boards[l].name, boards[l].sent, boards[l].lost,
+             boards[l].corrupted );
+
+  return 0;
+}
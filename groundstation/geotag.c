@@ -0,0 +1,444 @@
+/**********************************************
+ * UCSD E4E Stabilized Aerial Camera Platform *
+ * Flight Log Geotagger                       *
+ *                                            *
+ * File: UCSD-E4E/sacp/groundstation/geotag.c *
+ * Requires ./exif.h ./sacplog.h              *
+ **********************************************/
+
+#include <dirent.h>
+#include <pthread.h>
+#include <strings.h>
+#include <unistd.h>
+#include "exif.h"
+
+/* Most default tolerance, in seconds, between a shutter report and the
+ * camera's own timestamp once the clock offset is taken out */
+#define DEF_TOL 1.0
+
+/* Default tolerance as a share of the median gap between shutter reports.
+ * Just under half, so the offset clusters one frame apart never merge: at
+ * exactly half, v4's steady 2 s interval matched every image one off. */
+#define TOL_SHARE 0.45
+
+/* Least tolerance camera timestamps can be matched with. Camera clocks only
+ * count whole seconds, so after the offset a stamp is anywhere within 0.5 s
+ * of its shot, plus the shutter report's own lag. v5 multishoot firing near
+ * its 1 s MS_MIN_INTERVAL comes under this and is matched by sequence. */
+#define STAMP_TOL 0.6
+
+/* How far apart (in list position) an image and a shutter report can be
+ * and still vote on the camera clock offset. Covers that many dropped or
+ * extra frames near the start of the flight. */
+#define VOTE_BAND 64
+
+#define SEC_PER_WEEK 604800.0
+
+void usage() {
+  puts( "\ngeotag [-n] [-s] [-j threads] [-t tolerance] <capture> <image dir>\n" );
+  puts( "  capture    camera board serial capture with takePicture() GPS lines" );
+  puts( "  image dir  directory of JPEGs from the flight, named in shot order" );
+  puts( "  -n         only print the image to shutter report matching"         );
+  puts( "  -s         match by sequence only, ignoring camera timestamps"      );
+  puts( "  -j         number of worker threads (default: one per cpu)"         );
+  printf( "  -t         matching tolerance in seconds (default: %.2f of the\n"
+          "             median shutter interval, at most %.1f)\n", TOL_SHARE,
+          DEF_TOL );
+}
+
+/* struct for one image in the directory */
+typedef struct image {
+  char*  path;
+  double t;     /* camera time, seconds of the week, if has_t */
+  int    has_t;
+  long   ev;    /* matched shutter report, or -1 */
+} image;
+
+/* struct shared by worker threads; next hands out images one at a time */
+typedef struct work {
+  image*        imgs;
+  long          n;
+  long          next;
+  const gpsfix* fixes;
+  long          failed;
+} work;
+
+
+/* double secOfWeek( "YYYY:MM:DD HH:MM:SS" )
+ *
+ * Returns seconds since the start of the (GPS, Sunday based) week the
+ * timestamp falls in, or -1.0 if it doesn't parse. Camera clocks are
+ * usually local time, which ends up in the clock offset along with the
+ * GPS/UTC leap seconds.
+ */
+double secOfWeek( const char* s ) {
+  int y, mo, d, h, mi, se;
+
+  if( sscanf( s, "%d:%d:%d %d:%d:%d", &y, &mo, &d, &h, &mi, &se ) != 6 ||
+      mo < 1 || 12 < mo )
+    return -1.0;
+
+  /* days since 1970-01-01 (a Thursday), civil calendar */
+  y -= mo <= 2;
+  long era = ( y >= 0 ? y : y - 399 )/400;
+  long yoe = y - era*400;
+  long doy = ( 153*( mo + ( mo > 2 ? -3 : 9 ) ) + 2 )/5 + d - 1;
+  long doe = yoe*365 + yoe/4 - yoe/100 + doy;
+  long days = era*146097 + doe - 719468;
+
+  long dow = ( ( days + 4 ) % 7 + 7 ) % 7;
+  return dow*86400.0 + h*3600.0 + mi*60.0 + se;
+}
+
+/* double weekWrap( time difference in seconds )
+ *
+ * Wraps a time of week difference into [-half week, half week).
+ */
+double weekWrap( double dt ) {
+  dt = fmod( dt + 0.5*SEC_PER_WEEK, SEC_PER_WEEK );
+  if( dt < 0 ) dt += SEC_PER_WEEK;
+  return dt - 0.5*SEC_PER_WEEK;
+}
+
+int cmpDouble( const void* a, const void* b ) {
+  double x = *(const double*)a, y = *(const double*)b;
+  return ( x > y ) - ( x < y );
+}
+
+/* double defaultTol( fixes, count )
+ *
+ * TOL_SHARE of the median gap between consecutive shutter reports, at most
+ * DEF_TOL. DEF_TOL if there are too few reports to tell.
+ */
+double defaultTol( const gpsfix* fixes, long m ) {
+  double* gaps;
+  long i;
+
+  if( m < 2 || !( gaps = (double*)malloc( ( m - 1 )*sizeof(double) ) ) )
+    return DEF_TOL;
+
+  for( i = 1; i < m; ++i )
+    gaps[i-1] = weekWrap( ( fixes[i].time - fixes[i-1].time )/1000.0 );
+  qsort( gaps, m - 1, sizeof(double), cmpDouble );
+
+  double tol = TOL_SHARE*gaps[( m - 1 )/2];
+  free( gaps );
+  return fmin( DEF_TOL, tol );
+}
+
+int cmpName( const void* a, const void* b ) {
+  return strcmp( ((const image*)a)->path, ((const image*)b)->path );
+}
+
+
+/* void* scanWorker( work )
+ *
+ * Thread body for the first pass: reads the camera timestamp of each image.
+ */
+void* scanWorker( void* arg ) {
+  work* w = (work*)arg;
+  jpeginfo* info = (jpeginfo*)malloc( sizeof(jpeginfo) );
+  char stamp[20];
+  long i;
+
+  if( !info ) return NULL;
+
+  while( ( i = __atomic_fetch_add( &w->next, 1, __ATOMIC_RELAXED ) ) < w->n ) {
+    image* im = &w->imgs[i];
+    int fd = open( im->path, O_RDONLY );
+
+    if( 0 <= fd && !jpegScan( fd, info ) && !exifDateTime( info, stamp ) ) {
+      im->t = secOfWeek( stamp );
+      im->has_t = 0.0 <= im->t;
+    }
+    if( 0 <= fd ) close( fd );
+  }
+
+  free( info );
+  return NULL;
+}
+
+/* void* tagWorker( work )
+ *
+ * Thread body for the second pass: writes the matched fix into each image.
+ */
+void* tagWorker( void* arg ) {
+  work* w = (work*)arg;
+  jpeginfo* info = (jpeginfo*)malloc( sizeof(jpeginfo) );
+  unsigned char* seg = (unsigned char*)malloc( APP1_SEG );
+  long i;
+
+  if( !info || !seg ) {
+    __atomic_fetch_add( &w->failed, 1, __ATOMIC_RELAXED );
+    free( info ); free( seg );
+    return NULL;
+  }
+
+  while( ( i = __atomic_fetch_add( &w->next, 1, __ATOMIC_RELAXED ) ) < w->n ) {
+    image* im = &w->imgs[i];
+    if( im->ev < 0 ) continue;
+
+    if( jpegGeotag( im->path, info, &w->fixes[im->ev], seg ) ) {
+      fprintf( stderr, "%s: %s\n", im->path, strerror( errno ) );
+      __atomic_fetch_add( &w->failed, 1, __ATOMIC_RELAXED );
+    }
+  }
+
+  free( info ); free( seg );
+  return NULL;
+}
+
+/* void runWorkers( thread body, work, number of threads ) */
+void runWorkers( void* (*body)( void* ), work* w, int nthreads ) {
+  pthread_t* tids = (pthread_t*)malloc( nthreads*sizeof(pthread_t) );
+  int i, started = 0;
+
+  w->next = 0;
+  for( i = 0; tids && i < nthreads; ++i )
+    if( !pthread_create( &tids[i], NULL, body, w ) ) ++started;
+
+  /* no threads to be had, do it ourselves */
+  if( !started ) body( w );
+
+  for( i = 0; i < started; ++i ) pthread_join( tids[i], NULL );
+  free( tids );
+}
+
+
+/* long matchByTime( images, count, fixes, count, offset, tolerance,
+ *                   address of residual sum )
+ *
+ * Walks both lists in time order, pairing an image with a shutter report
+ * when they agree to within the tolerance. A report nobody matches is a
+ * dropped frame, an image nobody matches is an extra one. When two images
+ * would both fit a report the closer one gets it.
+ *
+ * Returns the number of pairs made, and the sum of their |residuals|.
+ */
+long matchByTime( image* imgs, long n, const gpsfix* fixes, long m,
+                  double off, double tol, double* resid ) {
+  long i = 0, j = 0, matched = 0;
+
+  *resid = 0.0;
+  for( i = 0; i < n; ++i ) imgs[i].ev = -1;
+
+  i = 0;
+  while( i < n && j < m ) {
+    if( !imgs[i].has_t ) { ++i; continue; }
+
+    double r = weekWrap( imgs[i].t - off - fixes[j].time/1000.0 );
+
+    if( r < -tol ) ++i;
+    else if( tol < r ) ++j;
+    else {
+      long k = i + 1;
+      while( k < n && !imgs[k].has_t ) ++k;
+      if( k < n && fabs( weekWrap( imgs[k].t - off - fixes[j].time/1000.0 ) )
+                   < fabs( r ) ) {
+        ++i; continue;
+      }
+      imgs[i++].ev = j++;
+      *resid += fabs( r );
+      ++matched;
+    }
+  }
+
+  return matched;
+}
+
+/* double clockOffset( images, count, fixes, count, tolerance )
+ *
+ * Estimates camera clock minus GPS time. Every image votes for the offset
+ * to each shutter report near it in sequence, and the votes are grouped
+ * into tolerance-wide clusters. With a steady multishoot interval the
+ * clusters one frame apart are nearly as full as the right one, so rather
+ * than trusting the vote count each strong cluster is tried as a full
+ * match. The one pairing up the most frames wins; among equals, the one
+ * that keeps pairs closest to their place in sequence (both lists start
+ * at the first shot), then the one with the smallest residuals.
+ */
+double clockOffset( image* imgs, long n, const gpsfix* fixes, long m,
+                    double tol ) {
+  double* votes = (double*)malloc( n*( 2*VOTE_BAND + 1 )*sizeof(double) );
+  long i, j, nv = 0;
+
+  if( !votes ) return 0.0;
+
+  for( i = 0; i < n; ++i ) {
+    if( !imgs[i].has_t ) continue;
+    for( j = i - VOTE_BAND; j <= i + VOTE_BAND; ++j )
+      if( 0 <= j && j < m )
+        votes[nv++] = weekWrap( imgs[i].t - fixes[j].time/1000.0 );
+  }
+
+  qsort( votes, nv, sizeof(double), cmpDouble );
+
+  /* size of the fullest cluster, so weak ones can be skipped */
+  long lo, hi, most = 0;
+  for( lo = hi = 0; hi < nv; ++hi ) {
+    while( 2*tol < votes[hi] - votes[lo] ) ++lo;
+    if( most < hi - lo + 1 ) most = hi - lo + 1;
+  }
+
+  double off = nv ? votes[nv/2] : 0.0, bestres = 0.0;
+  long best = -1, bestseq = 0;
+  for( lo = 0; lo < nv; lo = hi ) {
+    for( hi = lo; hi < nv && votes[hi] - votes[lo] <= 2*tol; ++hi );
+    if( 2*( hi - lo ) < most ) continue;
+
+    double cand = votes[( lo + hi )/2], res;
+    long k = matchByTime( imgs, n, fixes, m, cand, tol, &res ), seq = 0;
+    for( i = 0; i < n; ++i )
+      if( 0 <= imgs[i].ev ) seq += labs( i - imgs[i].ev );
+
+    if( best < k || ( best == k && ( seq < bestseq ||
+                                     ( seq == bestseq && res < bestres ) ) ) ) {
+      best = k; bestseq = seq; bestres = res; off = cand;
+    }
+  }
+
+  free( votes );
+  return off;
+}
+
+
+int main( int argc, char** argv ) {
+
+  /* options */
+  double tol = DEF_TOL;
+  int dry = 0, seqonly = 0, settol = 0;
+  int nthreads = (int)sysconf( _SC_NPROCESSORS_ONLN );
+  int c;
+
+  while( ( c = getopt( argc, argv, "nsj:t:" ) ) != -1 ) {
+    switch( c ) {
+      case 'n': dry = 1; break;
+      case 's': seqonly = 1; break;
+      case 'j': nthreads = atoi( optarg ); break;
+      case 't': tol = atof( optarg ); settol = 1; break;
+      default: usage(); return -1;
+    }
+  }
+
+  if( argc - optind != 2 || nthreads < 1 || !( 0.0 < tol ) ) {
+    usage();
+    return -1;
+  }
+
+  /******************** Shutter reports from the capture *********************/
+  FILE* cap = fopen( argv[optind], "r" );
+  if( !cap ) {
+    fprintf( stderr, "\nCould not open capture %s\n", argv[optind] );
+    return -1;
+  }
+
+  gpsfix* fixes;
+  long m = readGpsLog( cap, &fixes );
+  fclose( cap );
+
+  if( m < 0 ) {
+    fprintf( stderr, "There was a problem allocating memory." );
+    return -1;
+  }
+
+  if( !settol ) {
+    tol = defaultTol( fixes, m );
+    if( !seqonly && tol < STAMP_TOL ) {
+      fprintf( stderr, "Shutter reports too close together for whole second "
+               "camera timestamps, matching by sequence only\n" );
+      seqonly = 1;
+    }
+  }
+
+  /*************************** Images in the directory ***********************/
+  const char* dirname = argv[optind + 1];
+  DIR* dir = opendir( dirname );
+  if( !dir ) {
+    fprintf( stderr, "\nCould not open image directory %s\n", dirname );
+    return -1;
+  }
+
+  long n = 0, cap_n = 1024;
+  image* imgs = (image*)malloc( cap_n*sizeof(image) );
+  struct dirent* de;
+
+  while( imgs && ( de = readdir( dir ) ) ) {
+    const char* ext = strrchr( de->d_name, '.' );
+    if( !ext || ( strcasecmp( ext, ".jpg" ) && strcasecmp( ext, ".jpeg" ) ) )
+      continue;
+
+    if( n == cap_n ) {
+      image* grown = (image*)realloc( imgs, 2*cap_n*sizeof(image) );
+      if( !grown ) { free( imgs ); imgs = NULL; break; }
+      imgs = grown; cap_n *= 2;
+    }
+
+    image* im = &imgs[n];
+    im->path = (char*)malloc( strlen( dirname ) + strlen( de->d_name ) + 2 );
+    if( !im->path ) { free( imgs ); imgs = NULL; break; }
+    sprintf( im->path, "%s/%s", dirname, de->d_name );
+    im->has_t = 0; im->ev = -1;
+    ++n;
+  }
+  closedir( dir );
+
+  if( !imgs ) {
+    fprintf( stderr, "There was a problem allocating memory." );
+    return -1;
+  }
+
+  qsort( imgs, n, sizeof(image), cmpName );
+
+  /****************** Match images to shutter reports ************************/
+  work w = { imgs, n, 0, fixes, 0 };
+  long i, timed = 0;
+
+  if( !seqonly ) {
+    runWorkers( scanWorker, &w, nthreads );
+    for( i = 0; i < n; ++i ) timed += imgs[i].has_t;
+  }
+
+  if( timed ) {
+    double off = clockOffset( imgs, n, fixes, m, tol );
+    fprintf( stderr, "Camera clock offset: %+.1f s (tolerance %.1f s)\n", off,
+             tol );
+    double res;
+    matchByTime( imgs, n, fixes, m, off, tol, &res );
+  }
+  else {
+    if( !seqonly )
+      fprintf( stderr, "No camera timestamps, matching by sequence only\n" );
+    if( n != m )
+      fprintf( stderr, "Warning: %ld images but %ld shutter reports\n", n, m );
+    for( i = 0; i < n && i < m; ++i ) imgs[i].ev = i;
+  }
+
+  long matched = 0;
+  for( i = 0; i < n; ++i ) {
+    if( imgs[i].ev < 0 ) {
+      printf( "%s\t-\n", imgs[i].path );
+      continue;
+    }
+    const gpsfix* f = &fixes[imgs[i].ev];
+    printf( "%s\t%ld\t%ld\t%.7f\t%.7f\t%.1f\n", imgs[i].path, imgs[i].ev,
+            f->time, f->lat/1e7, f->lon/1e7, f->alt );
+    ++matched;
+  }
+
+  fprintf( stderr, "%ld images, %ld shutter reports: %ld matched, "
+           "%ld extra images, %ld dropped frames\n",
+           n, m, matched, n - matched, m - matched );
+
+  /********************** Write the tags *************************************/
+  if( !dry ) runWorkers( tagWorker, &w, nthreads );
+
+  for( i = 0; i < n; ++i ) free( imgs[i].path );
+  free( imgs ); free( fixes );
+
+  if( w.failed ) {
+    fprintf( stderr, "\n%ld images could not be tagged\n", w.failed );
+    return -1;
+  }
+
+  return 0;
+}
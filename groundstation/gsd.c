@@ -0,0 +1,530 @@
+/**********************************************
+ * UCSD E4E Stabilized Aerial Camera Platform *
+ * Ground Station Daemon                      *
+ *                                            *
+ * File: UCSD-E4E/sacp/groundstation/gsd.c    *
+ * Requires ./ring.h ./sacplog.h              *
+ **********************************************/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+#include "ring.h"
+#include "sacplog.h"
+
+/* Both boards run their serial monitor at this rate */
+#define DEF_BAUD 57600
+
+/* Per link, per direction ring size. At 57600 baud this is over 10 s of
+ * backlog, far more than a stalled terminal should ever cause. */
+#define RING_SIZE 65536
+
+/* Longest operator command line */
+#define CMD_MAX 256
+
+/* Commands each board's loop() understands. Lines are routed by their
+ * first character. */
+#define CAM_CMDS  "tmlrcjg"
+#define MEGA_CMDS "dayfnqzwsp"
+
+/* epoll tags for the non-link descriptors */
+#define EV_STDIN  NLINKS
+#define EV_SIGNAL ( NLINKS + 1 )
+#define EV_TIMER  ( NLINKS + 2 )
+
+void usage() {
+  puts( "\ngsd [-b baud] [-l log] <mega tty> <camera tty>"                    );
+  puts( "gsd -r log [-x speed] [-v]\n"                                         );
+  puts( "  Runs both serial links: every received line is printed with its"   );
+  puts( "  arrival time and link, and every line typed on stdin is sent to"   );
+  printf( "  the board that understands it (%s: camera, %s: mega).\n",
+          CAM_CMDS, MEGA_CMDS );
+  puts( "  -l   record every byte in and out to a replayable log"              );
+  puts( "  -r   replay a log instead, printing what gsd printed live"          );
+  puts( "  -x   replay speed factor (default 0: as fast as possible)"          );
+  puts( "  -v   replay byte by byte, with the arrival time of each byte"       );
+  printf( "  -b   baud rate (default: %d)\n", DEF_BAUD );
+}
+
+/* struct for one serial link */
+typedef struct slink {
+  const char* name;
+  const char* path;
+  int fd;
+  ring rx, tx;
+  size_t scanned;          /* bytes of rx already searched for a newline */
+  int64_t last;            /* arrival time of the newest rx bytes */
+  int out;                 /* EPOLLOUT armed? */
+
+  /* statistics */
+  unsigned long long nrx, ntx, nreads, drops;
+  size_t peak;
+} slink;
+
+slink links[NLINKS] = {
+  { "mega", NULL, -1 },
+  { "cam",  NULL, -1 }
+};
+
+int epfd, logfd = -1;
+uint32_t baud = DEF_BAUD;
+
+
+/* int64_t now() - CLOCK_REALTIME in ns */
+int64_t now() {
+  struct timespec ts;
+  clock_gettime( CLOCK_REALTIME, &ts );
+  return ts.tv_sec*1000000000LL + ts.tv_nsec;
+}
+
+/* speed_t baudBits( baud rate ) - termios constant, or B0 if unsupported */
+speed_t baudBits( uint32_t b ) {
+  switch( b ) {
+    case 9600:   return B9600;
+    case 19200:  return B19200;
+    case 38400:  return B38400;
+    case 57600:  return B57600;
+    case 115200: return B115200;
+    case 230400: return B230400;
+    default:     return B0;
+  }
+}
+
+/* int watch( fd, epoll tag, events, op ) - epoll_ctl shorthand */
+int watch( int fd, int tag, unsigned events, int op ) {
+  struct epoll_event ev;
+  ev.events = events;
+  ev.data.u32 = tag;
+  return epoll_ctl( epfd, op, fd, &ev );
+}
+
+/* int linkOpen( link number )
+ *
+ * Opens the link's tty raw and non-blocking at the configured baud rate
+ * (ignored by pseudo-terminals) and adds it to the epoll set.
+ *
+ * Returns 0 on success, -1 on failure (the link stays down).
+ */
+int linkOpen( int l ) {
+  slink* k = &links[l];
+  struct termios tio;
+
+  k->fd = open( k->path, O_RDWR | O_NOCTTY | O_NONBLOCK );
+  if( k->fd < 0 ) return -1;
+
+  if( !tcgetattr( k->fd, &tio ) ) {
+    cfmakeraw( &tio );
+    cfsetspeed( &tio, baudBits( baud ) );
+    tio.c_cflag |= CLOCAL | CREAD;
+    tcsetattr( k->fd, TCSANOW, &tio );
+  }
+
+  k->out = 0;
+  if( watch( k->fd, l, EPOLLIN, EPOLL_CTL_ADD ) ) {
+    close( k->fd ); k->fd = -1;
+    return -1;
+  }
+  return 0;
+}
+
+/* void linkDown( link number )
+ *
+ * Closes a link that hung up or errored. The timer reopens it, so a board
+ * that resets or a cable that drops out comes back on its own.
+ */
+void linkDown( int l ) {
+  slink* k = &links[l];
+  if( k->fd < 0 ) return;
+
+  fprintf( stderr, "%s: link down (%s)\n", k->name, k->path );
+  epoll_ctl( epfd, EPOLL_CTL_DEL, k->fd, NULL );
+  close( k->fd );
+  k->fd = -1;
+  ++k->drops;
+}
+
+
+/* void logRec( link, direction, time, ring, offset, length )
+ *
+ * Appends one record to the log, its bytes taken straight from the ring.
+ */
+void logRec( int l, int dir, int64_t t, ring* r, size_t off, size_t len ) {
+  struct iovec iov[3];
+  gsrec rec;
+
+  if( logfd < 0 || !len ) return;
+
+  memset( &rec, 0, sizeof(rec) );
+  rec.ns = t; rec.link = l; rec.dir = dir; rec.len = len;
+  iov[0].iov_base = &rec; iov[0].iov_len = sizeof(rec);
+
+  int k = ringSpans( r, off, len, iov+1 );
+  if( writev( logfd, iov, k+1 ) < 0 ) {
+    perror( "log" );
+    close( logfd ); logfd = -1;
+  }
+}
+
+/* void showLine( output fd, time, link name, tag, spans, count )
+ *
+ * Writes "<sec>.<usec> <name><tag> " followed by the spans.
+ */
+void showLine( int fd, int64_t t, const char* name, char tag,
+               struct iovec* spans, int k ) {
+  char prefix[64];
+  struct iovec iov[3];
+  int i;
+
+  iov[0].iov_base = prefix;
+  iov[0].iov_len = snprintf( prefix, sizeof(prefix), "%lld.%06lld %s%c ",
+                             (long long)( t/1000000000 ),
+                             (long long)( t%1000000000/1000 ), name, tag );
+  for( i = 0; i < k; ++i ) iov[i+1] = spans[i];
+  if( writev( fd, iov, k+1 ) < 0 && errno != EAGAIN ) perror( "stdout" );
+}
+
+/* void linkRead( link number )
+ *
+ * Reads whatever the link has straight into its rx ring, logs it and
+ * prints every complete line. A partial line stays in the ring until its
+ * newline arrives, unless the ring fills up first.
+ */
+void linkRead( int l ) {
+  slink* k = &links[l];
+  struct iovec iov[2];
+
+  for( ;; ) {
+    size_t space = ringSpace( &k->rx );
+    if( 65535 < space ) space = 65535;   /* gsrec.len */
+
+    int n = ringSpans( &k->rx, ringUsed( &k->rx ), space, iov );
+    ssize_t got = readv( k->fd, iov, n );
+
+    if( got < 0 && errno == EAGAIN ) return;
+    if( got <= 0 ) { linkDown( l ); return; }
+
+    k->last = now();
+    logRec( l, DIR_RX, k->last, &k->rx, ringUsed( &k->rx ), got );
+    ringProduce( &k->rx, got );
+    k->nrx += got; ++k->nreads;
+    if( k->peak < ringUsed( &k->rx ) ) k->peak = ringUsed( &k->rx );
+
+    /* print complete lines */
+    size_t used = ringUsed( &k->rx );
+    while( k->scanned < used ) {
+      if( ringAt( &k->rx, k->scanned++ ) != '\n' ) continue;
+      n = ringSpans( &k->rx, 0, k->scanned, iov );
+      showLine( STDOUT_FILENO, k->last, k->name, ':', iov, n );
+      ringConsume( &k->rx, k->scanned );
+      used = ringUsed( &k->rx );
+      k->scanned = 0;
+    }
+
+    if( !ringSpace( &k->rx ) ) {
+      n = ringSpans( &k->rx, 0, used, iov );
+      showLine( STDOUT_FILENO, k->last, k->name, ':', iov, n );
+      if( write( STDOUT_FILENO, "\n", 1 ) < 0 ) perror( "stdout" );
+      ringConsume( &k->rx, used );
+      k->scanned = 0;
+    }
+  }
+}
+
+/* void linkWrite( link number )
+ *
+ * Sends as much of the tx ring as the link takes, and arms EPOLLOUT for
+ * the rest.
+ */
+void linkWrite( int l ) {
+  slink* k = &links[l];
+  struct iovec iov[2];
+
+  while( 0 <= k->fd && ringUsed( &k->tx ) ) {
+    int n = ringSpans( &k->tx, 0, ringUsed( &k->tx ), iov );
+    ssize_t put = writev( k->fd, iov, n );
+    if( put < 0 && errno == EAGAIN ) break;
+    if( put <= 0 ) { linkDown( l ); return; }
+    ringConsume( &k->tx, put );
+    k->ntx += put;
+  }
+
+  int want = 0 < ringUsed( &k->tx );
+  if( 0 <= k->fd && want != k->out ) {
+    watch( k->fd, l, want ? EPOLLIN | EPOLLOUT : EPOLLIN, EPOLL_CTL_MOD );
+    k->out = want;
+  }
+}
+
+/* void command( line typed by the operator, length without newline )
+ *
+ * Routes a command line to its board. The Mega gets the newline too: it
+ * ends the number after 'y' or 'p' so Serial.parseInt()/parseFloat() return
+ * at once instead of waiting out their one second timeout. The camera
+ * board echoes anything it doesn't know, so it gets no newline.
+ */
+void command( char* line, size_t len ) {
+  int l;
+
+  if( !len ) return;
+  if( strchr( CAM_CMDS, line[0] ) ) l = LINK_CAM;
+  else if( strchr( MEGA_CMDS, line[0] ) ) l = LINK_MEGA;
+  else {
+    fprintf( stderr, "unknown command '%c'\n", line[0] );
+    return;
+  }
+
+  slink* k = &links[l];
+  if( l == LINK_MEGA ) line[len++] = '\n';
+
+  if( ringSpace( &k->tx ) < len ) {
+    fprintf( stderr, "%s: tx backlog full, command dropped\n", k->name );
+    return;
+  }
+
+  size_t off = ringUsed( &k->tx );
+  ringPut( &k->tx, line, len );
+
+  struct iovec iov[2];
+  int n = ringSpans( &k->tx, off, len, iov );
+  int64_t t = now();
+  logRec( l, DIR_TX, t, &k->tx, off, len );
+  showLine( STDOUT_FILENO, t, k->name, '<', iov, n );
+  if( l == LINK_CAM && write( STDOUT_FILENO, "\n", 1 ) < 0 ) perror( "stdout" );
+
+  linkWrite( l );
+}
+
+
+/* int replay( log file, speed factor, byte by byte? )
+ *
+ * Prints a log the way gsd printed it live: received lines with the
+ * arrival time of their last chunk, sent commands as they went out. With
+ * a nonzero speed the original timing is reproduced (2 = twice as fast).
+ */
+int replay( const char* path, double speed, int bytes ) {
+  FILE* in = fopen( path, "rb" );
+  gslhead head;
+  gsrec rec;
+  unsigned char data[65536];
+  static char line[NLINKS][RING_SIZE];
+  size_t fill[NLINKS] = { 0, 0 };
+  int64_t first = 0, start = now();
+
+  if( !in || fread( &head, sizeof(head), 1, in ) != 1 ||
+      memcmp( head.magic, GSL_MAGIC, 8 ) || !head.baud ) {
+    fprintf( stderr, "\n%s is not a gsd log\n", path );
+    if( in ) fclose( in );
+    return -1;
+  }
+
+  while( fread( &rec, sizeof(rec), 1, in ) == 1 ) {
+    if( NLINKS <= rec.link || fread( data, 1, rec.len, in ) != rec.len ) {
+      fprintf( stderr, "\nTruncated or damaged record, stopping\n" );
+      break;
+    }
+    if( !first ) first = rec.ns;
+
+    /* keep to the recorded timing */
+    if( 0.0 < speed ) {
+      int64_t due = start + (int64_t)( ( rec.ns - first )/speed ) - now();
+      if( 0 < due ) {
+        struct timespec ts = { due/1000000000, due%1000000000 };
+        nanosleep( &ts, NULL );
+      }
+    }
+
+    const char* name = links[rec.link].name;
+    int i;
+
+    if( bytes ) {
+      for( i = 0; i < rec.len; ++i ) {
+        int64_t t = rec.dir == DIR_RX ? byteTime( &rec, i, head.baud ) : rec.ns;
+        printf( "%lld.%09lld %s%c %02x %c\n", (long long)( t/1000000000 ),
+                (long long)( t%1000000000 ), name,
+                rec.dir == DIR_RX ? ':' : '<', data[i],
+                32 <= data[i] && data[i] < 127 ? data[i] : '.' );
+      }
+      continue;
+    }
+
+    struct iovec iov;
+    if( rec.dir == DIR_TX ) {
+      iov.iov_base = data;
+      iov.iov_len = rec.len - ( rec.len && data[rec.len-1] == '\n' );
+      fflush( stdout );
+      showLine( STDOUT_FILENO, rec.ns, name, '<', &iov, 1 );
+      if( write( STDOUT_FILENO, "\n", 1 ) < 0 ) perror( "stdout" );
+      continue;
+    }
+
+    /* same line splitting as linkRead() */
+    char* buf = line[rec.link];
+    size_t* f = &fill[rec.link];
+    for( i = 0; i < rec.len; ++i ) {
+      buf[(*f)++] = data[i];
+      if( data[i] == '\n' || *f == RING_SIZE ) {
+        iov.iov_base = buf; iov.iov_len = *f;
+        fflush( stdout );
+        showLine( STDOUT_FILENO, rec.ns, name, ':', &iov, 1 );
+        if( data[i] != '\n' && write( STDOUT_FILENO, "\n", 1 ) < 0 )
+          perror( "stdout" );
+        *f = 0;
+      }
+    }
+  }
+
+  fclose( in );
+  return 0;
+}
+
+
+int main( int argc, char** argv ) {
+  const char* logname = NULL;
+  const char* replayname = NULL;
+  double speed = 0.0;
+  int bytes = 0, c, l;
+
+  while( ( c = getopt( argc, argv, "b:l:r:x:v" ) ) != -1 ) {
+    switch( c ) {
+      case 'b': baud = atol( optarg ); break;
+      case 'l': logname = optarg; break;
+      case 'r': replayname = optarg; break;
+      case 'x': speed = atof( optarg ); break;
+      case 'v': bytes = 1; break;
+      default: usage(); return -1;
+    }
+  }
+
+  if( replayname ) return replay( replayname, speed, bytes );
+
+  if( argc - optind != 2 || baudBits( baud ) == B0 ) {
+    usage();
+    return -1;
+  }
+
+  links[LINK_MEGA].path = argv[optind];
+  links[LINK_CAM].path = argv[optind + 1];
+
+  /************************* Event sources ***********************************/
+  epfd = epoll_create1( 0 );
+
+  for( l = 0; l < NLINKS; ++l ) {
+    if( ringInit( &links[l].rx, RING_SIZE ) ||
+        ringInit( &links[l].tx, RING_SIZE ) ) {
+      fprintf( stderr, "There was a problem allocating memory." );
+      return -1;
+    }
+    if( linkOpen( l ) )
+      fprintf( stderr, "%s: can't open %s yet, will keep trying\n",
+               links[l].name, links[l].path );
+  }
+
+  /* SIGINT/SIGTERM end the loop cleanly so the log and stats get flushed */
+  sigset_t mask;
+  sigemptyset( &mask );
+  sigaddset( &mask, SIGINT ); sigaddset( &mask, SIGTERM );
+  sigprocmask( SIG_BLOCK, &mask, NULL );
+  signal( SIGPIPE, SIG_IGN );
+  int sigfd = signalfd( -1, &mask, SFD_NONBLOCK );
+
+  /* once a second, reopen links that are down */
+  int timerfd = timerfd_create( CLOCK_MONOTONIC, TFD_NONBLOCK );
+  struct itimerspec its = { { 1, 0 }, { 1, 0 } };
+  timerfd_settime( timerfd, 0, &its, NULL );
+
+  if( epfd < 0 || sigfd < 0 || timerfd < 0 ||
+      watch( sigfd, EV_SIGNAL, EPOLLIN, EPOLL_CTL_ADD ) ||
+      watch( timerfd, EV_TIMER, EPOLLIN, EPOLL_CTL_ADD ) ) {
+    perror( "gsd" );
+    return -1;
+  }
+
+  /* stdin may be a regular file when running unattended, which epoll
+   * refuses; commands then simply aren't taken */
+  watch( STDIN_FILENO, EV_STDIN, EPOLLIN, EPOLL_CTL_ADD );
+
+  if( logname ) {
+    gslhead head;
+    memset( &head, 0, sizeof(head) );
+    memcpy( head.magic, GSL_MAGIC, 8 );
+    head.baud = baud;
+    logfd = open( logname, O_WRONLY | O_CREAT | O_TRUNC, 0644 );
+    if( logfd < 0 || write( logfd, &head, sizeof(head) ) != sizeof(head) ) {
+      fprintf( stderr, "\nCould not open log %s\n", logname );
+      return -1;
+    }
+  }
+
+  /************************* Event loop **************************************/
+  char cmd[CMD_MAX + 1];
+  size_t cmdlen = 0;
+  int running = 1;
+
+  while( running ) {
+    struct epoll_event evs[8];
+    int i, n = epoll_wait( epfd, evs, 8, -1 );
+
+    if( n < 0 && errno != EINTR ) { perror( "epoll_wait" ); break; }
+
+    for( i = 0; i < n; ++i ) {
+      unsigned tag = evs[i].data.u32;
+      unsigned e = evs[i].events;
+
+      if( tag < NLINKS ) {
+        if( links[tag].fd < 0 ) continue;
+        if( e & ( EPOLLIN | EPOLLHUP | EPOLLERR ) ) linkRead( tag );
+        if( 0 <= links[tag].fd && ( e & EPOLLOUT ) ) linkWrite( tag );
+      }
+
+      else if( tag == EV_STDIN ) {
+        char buf[512];
+        ssize_t got = read( STDIN_FILENO, buf, sizeof(buf) ), j;
+
+        if( got <= 0 ) {
+          epoll_ctl( epfd, EPOLL_CTL_DEL, STDIN_FILENO, NULL );
+          continue;
+        }
+        for( j = 0; j < got; ++j ) {
+          if( buf[j] == '\n' || cmdlen == CMD_MAX - 1 ) {
+            command( cmd, cmdlen );
+            cmdlen = 0;
+          }
+          if( buf[j] != '\n' ) cmd[cmdlen++] = buf[j];
+        }
+      }
+
+      else if( tag == EV_TIMER ) {
+        uint64_t ticks;
+        if( read( timerfd, &ticks, sizeof(ticks) ) < 0 ) continue;
+        for( l = 0; l < NLINKS; ++l )
+          if( links[l].fd < 0 && !linkOpen( l ) ) {
+            fprintf( stderr, "%s: link up (%s)\n", links[l].name,
+                     links[l].path );
+            linkWrite( l );
+          }
+      }
+
+      else if( tag == EV_SIGNAL ) running = 0;
+    }
+  }
+
+  /************************* Shutdown ****************************************/
+  if( 0 <= logfd ) close( logfd );
+
+  for( l = 0; l < NLINKS; ++l ) {
+    slink* k = &links[l];
+    fprintf( stderr, "%s: %llu bytes in (%llu reads), %llu bytes out, "
+             "peak backlog %zu, %llu dropouts\n", k->name, k->nrx, k->nreads,
+             k->ntx, k->peak, k->drops );
+    if( 0 <= k->fd ) close( k->fd );
+    ringFree( &k->rx ); ringFree( &k->tx );
+  }
+
+  return 0;
+}
@@ -0,0 +1,311 @@
+/**********************************************
+ * UCSD E4E Stabilized Aerial Camera Platform *
+ * Multishoot Simulator                       *
+ *                                            *
+ * File: UCSD-E4E/sacp/groundstation/mssim.c  *
+ * Requires ./sacplog.h                       *
+ *   ../Arduino/cameraControlv5/multishoot.h  *
+ **********************************************/
+
+#include <math.h>
+#include <unistd.h>
+#include "sacplog.h"
+#include "../Arduino/cameraControlv5/multishoot.h"
+
+/* Flies the camera board's multishoot over a recorded GPS track and
+ * measures the forward overlap each frame really got, for the fixed
+ * interval of cameraControlv4 and the adaptive scheduler of
+ * cameraControlv5. The scheduler code is the firmware's own. A GPS
+ * dropout can be added to see the scheduler's fallback for itself. */
+
+/* Default lens and sensor, mm (cameraControlv5) */
+#define DEF_FOCAL 35.0
+#define DEF_SENSOR 24.0
+
+/* cameraControlv4's multishoot interval, ms */
+#define FIXED_MS 2000
+
+/* Simulation step, ms: about one pass through the firmware's loop() */
+#define STEP_MS 10
+
+/* Frames this far under the target overlap are counted as short */
+#define SHORT_MARGIN 10.0
+
+#define EARTH_RADIUS 6371000.0
+
+void usage() {
+  puts( "\nmssim [-f focal] [-w sensor] [-o overlap] [-g ground alt]"          );
+  puts( "      [-i interval] [-m min] [-M max] [-d dropout] [-v] <capture>\n"  );
+  puts( "  capture  camera board serial capture; its GPS lines are the track"  );
+  printf( "  -f       lens focal length, mm (default: %.0f)\n", DEF_FOCAL );
+  printf( "  -w       sensor size along the track, mm (default: %.0f)\n",
+          DEF_SENSOR );
+  printf( "  -o       target forward overlap, percent (default: %.0f)\n",
+          MS_OVERLAP );
+  puts( "  -g       ground altitude, m (default: the first fix, like the"      );
+  puts( "           firmware)"                                                 );
+  printf( "  -i       fixed interval to compare with, ms (default: %d)\n",
+          FIXED_MS );
+  printf( "  -m, -M   adaptive interval limits, ms (default: %d, %d)\n",
+          MS_MIN_INTERVAL, MS_MAX_INTERVAL );
+  puts( "  -d       lose the fix for this long, ms, halfway along the track"   );
+  puts( "           (default: 0, never)"                                      );
+  puts( "  -v       print every simulated frame"                              );
+}
+
+/* struct for one track point, in meters east/north of the first fix */
+typedef struct trkpt {
+  double t;       /* ms since the first fix */
+  double e, n;
+  double alt;
+  double speed;
+} trkpt;
+
+/* struct for the frames one scheduler took */
+typedef struct shots {
+  const char* name;
+  long   n;      /* frames after the first */
+  long   low;    /* of them, taken under MS_MIN_HEIGHT and left out */
+  long   fallback; /* of them, taken with no fix or no usable height */
+  double min, max, sum, sumsq;
+  long   nshort, ngaps;
+  double estErr;  /* worst |scheduler's own overlap - true overlap| */
+} shots;
+
+
+/* long loadTrack( capture, address of track array )
+ *
+ * Reads the capture's GPS reports, drops the ones without a fix and turns
+ * the rest into a track that starts at time 0 and position 0,0. Time of
+ * week wrapping at the end of the week is undone. Returns the number of
+ * points, or -1.
+ */
+long loadTrack( FILE* in, trkpt** track ) {
+  gpsfix* fixes;
+  long nf = readGpsLog( in, &fixes ), i, n = 0;
+
+  if( nf < 0 ) return -1;
+
+  trkpt* trk = (trkpt*)malloc( ( nf + 1 )*sizeof(trkpt) );
+  if( !trk ) { free( fixes ); return -1; }
+
+  const gpsfix* f0 = NULL;
+  double coslat = 1.0, t = 0.0;
+  long prev = 0;
+
+  for( i = 0; i < nf; ++i ) {
+    const gpsfix* f = &fixes[i];
+    if( !f->fix ) continue;
+
+    if( !f0 ) {
+      f0 = f;
+      coslat = cos( 1e-7*f->lat*M_PI/180.0 );
+    }
+    else {
+      long dt = f->time - prev;
+      if( dt < 0 ) dt += MS_PER_WEEK;
+      t += dt;
+    }
+    prev = f->time;
+
+    /* GPS reports can repeat a fix; keep time strictly increasing */
+    if( n && t <= trk[n-1].t ) continue;
+
+    trk[n].t     = t;
+    trk[n].e     = 1e-7*( f->lon - f0->lon )*M_PI/180.0*EARTH_RADIUS*coslat;
+    trk[n].n     = 1e-7*( f->lat - f0->lat )*M_PI/180.0*EARTH_RADIUS;
+    trk[n].alt   = f->alt;
+    trk[n].speed = f->speed;
+    ++n;
+  }
+
+  free( fixes );
+  *track = trk;
+  return n;
+}
+
+/* void trackAt( track, points, time, hint, point to fill in )
+ *
+ * Linear interpolation along the track. *hint is the segment the last
+ * call ended in; times only go forward, so the search starts there.
+ */
+void trackAt( const trkpt* trk, long n, double t, long* hint, trkpt* out ) {
+  long i = *hint;
+
+  while( i < n - 2 && trk[i+1].t <= t ) ++i;
+  *hint = i;
+
+  const trkpt* a = &trk[i];
+  const trkpt* b = &trk[i+1];
+  double u = ( t - a->t )/( b->t - a->t );
+
+  out->t     = t;
+  out->e     = a->e + u*( b->e - a->e );
+  out->n     = a->n + u*( b->n - a->n );
+  out->alt   = a->alt + u*( b->alt - a->alt );
+  out->speed = a->speed + u*( b->speed - a->speed );
+}
+
+/* double shotTaken( stats, scheduler, frame, last frame, ground, verbose )
+ *
+ * Works out the overlap a frame really got with the one before it, from
+ * the positions both were taken at. The footprint is the one at the
+ * lower of the two heights, which is what limits the overlap. Frames
+ * taken too low for a footprint only count towards the total. Returns
+ * the overlap, percent, or NAN for those.
+ */
+double shotTaken( shots* s, msched* m, const trkpt* p, const trkpt* last,
+                double ground, int verbose ) {
+  double height = fmin( p->alt, last->alt ) - ground;
+  double foot = msFootprint( m, height );
+  double dist = hypot( p->e - last->e, p->n - last->n );
+  double ov = MS_MIN_HEIGHT <= height ? 100.0*( 1.0 - dist/foot ) : NAN;
+
+  if( verbose )
+    printf( "%-8s %9.0f ms  %7.1f m  height %6.1f m  speed %5.2f m/s  "
+            "overlap %6.1f%%\n", s->name, p->t, dist, height, p->speed, ov );
+
+  ++s->n;
+  if( isnan( ov ) ) { ++s->low; return ov; }
+
+  if( s->n == s->low + 1 || ov < s->min ) s->min = ov;
+  if( s->n == s->low + 1 || s->max < ov ) s->max = ov;
+  s->sum += ov;
+  s->sumsq += ov*ov;
+  s->nshort += ov < m->overlap - SHORT_MARGIN;
+  s->ngaps += ov < 0.0;
+  return ov;
+}
+
+/* void report( stats, track length in km ) - one line of the results */
+void report( const shots* s, double km ) {
+  long m = s->n - s->low;
+  if( !m ) { printf( "%-10s no frames in the air\n", s->name ); return; }
+
+  double mean = s->sum/m;
+  double sd = sqrt( fmax( 0.0, s->sumsq/m - mean*mean ) );
+  printf( "%-10s %7ld %7ld %8.1f %7.1f %7.1f %7.1f %7.1f %7ld %6ld\n",
+          s->name, s->n + 1, s->low, 0.0 < km ? ( s->n + 1 )/km : 0.0, s->min,
+          mean, s->max, sd, s->nshort, s->ngaps );
+}
+
+
+int main( int argc, char** argv ) {
+  double focal = DEF_FOCAL, sensor = DEF_SENSOR, target = MS_OVERLAP;
+  double ground = NAN;
+  long fixedMs = FIXED_MS, minMs = MS_MIN_INTERVAL, maxMs = MS_MAX_INTERVAL;
+  long dropMs = 0;
+  int verbose = 0, c;
+
+  while( ( c = getopt( argc, argv, "f:w:o:g:i:m:M:d:v" ) ) != -1 ) {
+    switch( c ) {
+      case 'f': focal = atof( optarg ); break;
+      case 'w': sensor = atof( optarg ); break;
+      case 'o': target = atof( optarg ); break;
+      case 'g': ground = atof( optarg ); break;
+      case 'i': fixedMs = atol( optarg ); break;
+      case 'm': minMs = atol( optarg ); break;
+      case 'M': maxMs = atol( optarg ); break;
+      case 'd': dropMs = atol( optarg ); break;
+      case 'v': verbose = 1; break;
+      default: usage(); return -1;
+    }
+  }
+
+  if( optind + 1 != argc || !( 0.0 < focal && 0.0 < sensor ) ||
+      !( 0.0 <= target && target < 100.0 ) || fixedMs <= 0 || minMs <= 0 ||
+      maxMs < minMs || dropMs < 0 ) {
+    usage();
+    return -1;
+  }
+
+  FILE* in = fopen( argv[optind], "r" );
+  if( !in ) {
+    fprintf( stderr, "\nCould not open capture %s\n", argv[optind] );
+    return -1;
+  }
+
+  trkpt* trk;
+  long n = loadTrack( in, &trk ), i;
+  fclose( in );
+  if( n < 2 ) {
+    fprintf( stderr, "\nNeed at least two GPS fixes in %s\n", argv[optind] );
+    return -1;
+  }
+
+  if( isnan( ground ) ) ground = trk[0].alt;
+
+  /* the track itself */
+  double km = 0.0, hmin = INFINITY, hmax = -INFINITY, vmax = 0.0;
+  for( i = 0; i < n; ++i ) {
+    if( i ) km += 1e-3*hypot( trk[i].e - trk[i-1].e, trk[i].n - trk[i-1].n );
+    hmin = fmin( hmin, trk[i].alt - ground );
+    hmax = fmax( hmax, trk[i].alt - ground );
+    vmax = fmax( vmax, trk[i].speed );
+  }
+
+  msched ms;
+  msInit( &ms, focal, sensor, 0 );
+  ms.overlap = target;
+  ms.minInterval = minMs;
+  ms.maxInterval = maxMs;
+  ms.groundAlt = ground;
+
+  printf( "%ld fixes over %.1f s, %.2f km, height %.1f to %.1f m, "
+          "speed up to %.1f m/s\n", n, 1e-3*trk[n-1].t, km, hmin, hmax, vmax );
+  printf( "%.1f degree field of view along the track, target overlap "
+          "%.0f%%\n", msFov( focal, sensor ), target );
+
+  /* the dropout, centered on the middle of the track */
+  double dropFrom = 0.5*( trk[n-1].t - dropMs ), dropTo = dropFrom + dropMs;
+  if( dropMs )
+    printf( "no fix from %.1f s to %.1f s\n", 1e-3*dropFrom, 1e-3*dropTo );
+  putchar( '\n' );
+
+  /* both schedulers take their first frame at the first fix, then step
+   * through the track the way loop() would */
+  char fixedName[32];
+  snprintf( fixedName, sizeof(fixedName), "fixed %ld", fixedMs );
+  shots fixed = { fixedName }, adapt = { "adaptive" };
+  trkpt p, lastFixed = trk[0], lastAdapt = trk[0];
+  long hint = 0;
+  int blind = 0;   /* the board lost the fix since its last frame */
+  double t;
+
+  for( t = STEP_MS; t <= trk[n-1].t; t += STEP_MS ) {
+    trackAt( trk, n, t, &hint, &p );
+    int fix = !( dropFrom <= t && t < dropTo );
+    blind |= !fix;
+
+    if( fixedMs < t - lastFixed.t ) {
+      shotTaken( &fixed, &ms, &p, &lastFixed, ground, verbose );
+      lastFixed = p;
+    }
+
+    if( msUpdate( &ms, (long)t, fix, p.speed, p.alt ) ) {
+      double ov = shotTaken( &adapt, &ms, &p, &lastAdapt, ground, verbose );
+      adapt.fallback += !fix ||
+                        !msSpacing( &ms, fmin( p.alt, ms.shotAlt ) - ground );
+      msShot( &ms, (long)t, p.alt );
+      lastAdapt = p;
+
+      /* how far the Overlap: the firmware reports is from the truth; it
+       * can't count ground covered without a fix */
+      if( !isnan( ov ) && !blind )
+        adapt.estErr = fmax( adapt.estErr, fabs( ms.achieved - ov ) );
+      blind = !fix;
+    }
+  }
+
+  printf( "%-10s %7s %7s %8s %7s %7s %7s %7s %7s %6s\n", "scheduler",
+          "frames", "low", "per km", "min %", "mean %", "max %", "sd", "short", "gaps" );
+  report( &fixed, km );
+  report( &adapt, km );
+  printf( "\nadaptive Overlap: telemetry within %.1f%% of the true overlap\n",
+          adapt.estErr );
+  printf( "adaptive took %ld frames on its %ld ms fallback (no fix, or under "
+          "%.0f m)\n", adapt.fallback, ms.fallbackInterval, MS_MIN_HEIGHT );
+
+  free( trk );
+  return 0;
+}
@@ -0,0 +1,117 @@
+#ifndef SACPRING
+#define SACPRING
+
+/**********************************************
+ * UCSD E4E Stabilized Aerial Camera Platform *
+ * Ground Station                             *
+ *                                            *
+ * File: UCSD-E4E/sacp/groundstation/ring.h   *
+ *                                            *
+ * Compatibility: C99, POSIX                  *
+ **********************************************/
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+
+/*****************Byte ring buffers for serial links*****************
+ *
+ * Bytes go in and out with readv()/writev() straight on the ring memory,
+ * described as at most two iovecs (the wrap splits a span in two), so
+ * nothing is copied between the kernel and where the bytes are used.
+ */
+
+/* struct for a ring. size is a power of 2; head and tail only ever grow,
+ * their difference is the number of bytes held. */
+typedef struct ring {
+  unsigned char* buf;
+  size_t size;
+  size_t head;   /* total bytes ever put in */
+  size_t tail;   /* total bytes ever taken out */
+} ring;
+
+
+/* int ringInit( ring, size (rounded up to a power of 2) )
+ *
+ * Returns 0 on success, -1 if memory ran out.
+ */
+int ringInit( ring* r, size_t size ) {
+  r->size = 1;
+  while( r->size < size ) r->size <<= 1;
+  r->head = r->tail = 0;
+  r->buf = (unsigned char*)malloc( r->size );
+  return r->buf ? 0 : -1;
+}
+
+void ringFree( ring* r ) {
+  free( r->buf ); r->buf = NULL;
+}
+
+size_t ringUsed( const ring* r ) {
+  return r->head - r->tail;
+}
+
+size_t ringSpace( const ring* r ) {
+  return r->size - ( r->head - r->tail );
+}
+
+/* unsigned char ringAt( ring, offset from tail ) - byte at that offset */
+unsigned char ringAt( const ring* r, size_t off ) {
+  return r->buf[( r->tail + off ) & ( r->size - 1 )];
+}
+
+/* int ringSpans( ring, offset from tail, length, iovecs )
+ *
+ * Describes len bytes of ring memory starting off bytes past the tail with
+ * up to two iovecs. Use an offset of ringUsed() and a length of
+ * ringSpace() for the free space (to read() into).
+ *
+ * Returns the number of iovecs used (0 if len is 0).
+ */
+int ringSpans( const ring* r, size_t off, size_t len, struct iovec iov[2] ) {
+  size_t start = ( r->tail + off ) & ( r->size - 1 );
+  size_t first = r->size - start;
+
+  if( !len ) return 0;
+
+  iov[0].iov_base = r->buf + start;
+  if( len <= first ) {
+    iov[0].iov_len = len;
+    return 1;
+  }
+  iov[0].iov_len = first;
+  iov[1].iov_base = r->buf;
+  iov[1].iov_len = len - first;
+  return 2;
+}
+
+/* Marks n more bytes as put in (after reading into the free spans) */
+void ringProduce( ring* r, size_t n ) {
+  r->head += n;
+}
+
+/* Marks n bytes as taken out */
+void ringConsume( ring* r, size_t n ) {
+  r->tail += n;
+}
+
+/* size_t ringPut( ring, bytes, count )
+ *
+ * Copies bytes in, for the few places that don't come from a file
+ * descriptor (operator commands). Returns how many fit.
+ */
+size_t ringPut( ring* r, const void* src, size_t n ) {
+  struct iovec iov[2];
+  int i, k;
+
+  if( ringSpace( r ) < n ) n = ringSpace( r );
+  k = ringSpans( r, ringUsed( r ), n, iov );
+  for( i = 0; i < k; ++i ) {
+    memcpy( iov[i].iov_base, src, iov[i].iov_len );
+    src = (const unsigned char*)src + iov[i].iov_len;
+  }
+  ringProduce( r, n );
+  return n;
+}
+
+#endif /* SACPRING */
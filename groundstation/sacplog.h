@@ -0,0 +1,150 @@
+#ifndef SACPLOG
+#define SACPLOG
+
+/**********************************************
+ * UCSD E4E Stabilized Aerial Camera Platform *
+ * Ground Station                             *
+ *                                            *
+ * File: UCSD-E4E/sacp/groundstation/sacplog.h*
+ *                                            *
+ * Compatibility: C99                         *
+ **********************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+/************Serial capture parsing for the camera board**************/
+
+/* takePicture() in cameraControlv4 prints every GPS field straight from
+ * GPS_UBLOX after rescaling, which leaves some of them in odd units:
+ *
+ *   Time:   ms time of week (GPS time, not UTC)
+ *   Lat:    degrees * 10,000,000
+ *   Lon:    degrees * 10,000,000
+ *   Alt:    Altitude(cm) / 1000   -> multiply by ALT_PRINT_SCALE for meters
+ *   Speed:  Ground_Speed(cm/s) / 100, already m/s
+ *   Course: Ground_Course(deg*100) / 100000 -> multiply by COURSE_PRINT_SCALE
+ *
+ * cameraControlv5 adds the forward overlap multishoot achieved after these
+ * (Overlap:, percent), which parseGpsLine() leaves alone.
+ */
+#define ALT_PRINT_SCALE 10.0
+#define COURSE_PRINT_SCALE 1000.0
+
+/* GPS week length in ms, for wrapping time of week differences */
+#define MS_PER_WEEK 604800000L
+
+/* struct holding one "GPS: ..." shutter line, converted to sane units */
+typedef struct gpsfix {
+  long   time;    /* ms time of week */
+  int    fix;     /* 1: GPS fix, 0: no fix */
+  long   lat;     /* degrees * 1e7 */
+  long   lon;     /* degrees * 1e7 */
+  double alt;     /* meters above MSL */
+  double speed;   /* ground speed, m/s */
+  double course;  /* ground course, degrees */
+} gpsfix;
+
+
+/* int parseGpsLine( line of serial capture, fix to fill in )
+ *
+ * Fills in *out if the line holds a takePicture() GPS report. The report
+ * may be preceded by anything (serial monitor or ground station timestamps,
+ * leftover command echoes), so the "GPS:" tag is searched for rather than
+ * expected at the start of the line.
+ *
+ * Returns 1 if a report was parsed, 0 otherwise.
+ */
+int parseGpsLine( const char* line, gpsfix* out ) {
+  const char* tag = strstr( line, "GPS: Time:" );
+  double alt, speed, course;
+
+  if( !tag ) return 0;
+
+  if( sscanf( tag, "GPS: Time:%ld Fix:%d Lat:%ld Lon:%ld Alt:%lf Speed:%lf "
+                   "Course:%lf", &out->time, &out->fix, &out->lat, &out->lon,
+                   &alt, &speed, &course ) != 7 )
+    return 0;
+
+  out->alt    = ALT_PRINT_SCALE*alt;
+  out->speed  = speed;
+  out->course = COURSE_PRINT_SCALE*course;
+  return 1;
+}
+
+/* long readGpsLog( capture file, address of fix array )
+ *
+ * Reads every GPS report in the capture into a malloc'd array, in the order
+ * they were printed (which is shutter order). Other lines are skipped.
+ * Caller frees *fixes.
+ *
+ * Returns the number of reports read, or -1 if memory ran out.
+ */
+long readGpsLog( FILE* in, gpsfix** fixes ) {
+  char line[256];
+  long n = 0, cap = 256;
+  gpsfix* arr = (gpsfix*)malloc( cap*sizeof(gpsfix) );
+
+  if( !arr ) return -1;
+
+  while( fgets( line, sizeof(line), in ) ) {
+    if( n == cap ) {
+      gpsfix* grown = (gpsfix*)realloc( arr, 2*cap*sizeof(gpsfix) );
+      if( !grown ) { free( arr ); return -1; }
+      arr = grown; cap *= 2;
+    }
+    n += parseGpsLine( line, &arr[n] );
+  }
+
+  *fixes = arr;
+  return n;
+}
+
+
+/************Ground station link logs (written by gsd)**************
+ *
+ * A log is a gslhead followed by records, each a gsrec followed by its len
+ * bytes, in host byte order. A record is one read() or write() on a link,
+ * so every byte in it went over the wire back to back; the timestamp is
+ * when the read returned (or the write was issued), and the time of each
+ * byte within it follows from the baud rate (see byteTime()).
+ */
+
+#define GSL_MAGIC "SACPGSL1"
+
+/* Links and directions */
+#define LINK_MEGA 0
+#define LINK_CAM  1
+#define NLINKS    2
+#define DIR_RX    0
+#define DIR_TX    1
+
+/* Serial framing: 8N1 is 10 bits per byte */
+#define BITS_PER_BYTE 10
+
+typedef struct gslhead {
+  char     magic[8];
+  uint32_t baud;
+  uint32_t pad;
+} gslhead;
+
+typedef struct gsrec {
+  int64_t  ns;    /* CLOCK_REALTIME, ns since the epoch */
+  uint8_t  link;  /* LINK_MEGA or LINK_CAM */
+  uint8_t  dir;   /* DIR_RX or DIR_TX */
+  uint16_t len;   /* bytes following this header */
+  uint32_t pad;
+} gsrec;
+
+/* int64_t byteTime( record, index of byte in it, baud rate )
+ *
+ * Time the given byte of a received record finished arriving: the last
+ * byte arrived when the read returned, earlier ones one byte time apart.
+ */
+int64_t byteTime( const gsrec* r, int i, uint32_t baud ) {
+  return r->ns - ( r->len - 1 - i )*( BITS_PER_BYTE*1000000000LL/baud );
+}
+
+#endif /* SACPLOG */
@@ -0,0 +1,435 @@
+/**********************************************
+ * UCSD NGS Stabilized Aerial Camera Platform *
+ * Fleet Gigapan Planner                      *
+ *                                            *
+ * File: UCSD-E4E/sacp/panorama/fleet.c       *
+ * Requires ./gigapan.h ./planio.h            *
+ **********************************************/
+
+#include <pthread.h>
+#include "planio.h"
+
+/* Per-unit plan file names, numbered from 1 */
+#define UNIT_FILE "coords_%d.txt"
+
+/* Most platforms in a fleet */
+#define MAX_UNITS 64
+
+/* Bisection steps on the longest unit's time */
+#define BALANCE_STEPS 40
+
+/* Frames in the same yaw column can be this far apart, degrees: gridPlan()
+ * gets to a column's yaw by different sums of steps in different rows,
+ * which leaves a few bits of rounding between them, where real columns are
+ * a whole yaw step apart */
+#define YAW_SAME 1e-9
+
+/* Ways to split the gigapan: by yaw (columns) or by pitch (rows) */
+#define SPLIT_YAW 0
+#define SPLIT_PITCH 1
+
+void usage() {
+  puts( "\nfleet <units> <gimbal model file> <focal length> <sensor width>"  );
+  puts( "      <sensor height> <start yaw> <start pitch> <how right>"         );
+  puts( "      <how left> <how up> <how down> <horizontal overlap>"           );
+  puts( "      <vertical overlap> <optimize> [precision]\n"                   );
+  puts( "Lays out the same gigapan as gigapan given the same arguments, and"  );
+  puts( "shares its frames among that many platforms, each taking one"       );
+  puts( "contiguous block of yaw or of pitch, whichever finishes sooner."     );
+  puts( "Every frame goes to exactly one platform, so the seams between"      );
+  puts( "them keep the gigapan's overlap. The blocks are sized so the"       );
+  puts( "predicted times (from the gimbal model, see gimbal.txt) come out"   );
+  puts( "even; with - for the model, so the frame counts do. Each unit's"     );
+  printf( "plan is written to %s, in shooting order, with the given number\n",
+          UNIT_FILE );
+  printf( "of decimal places (default %d, %d for full precision).\n",
+          PLAN_PREC, PREC_EXACT );
+}
+
+/* struct for a gigapan being split among units along one axis */
+typedef struct split {
+  int axis;         /* SPLIT_YAW or SPLIT_PITCH */
+  frame* frames;    /* all frames, sorted along the axis */
+  long n;
+  long* first;      /* frames[first[i]] starts the i'th distinct key */
+  long m;           /* distinct keys; first[m] == n */
+  point* start;
+  gimbal* gim;      /* NULL: balance frame counts */
+  frame* scratch;   /* n frames to order units in */
+  estimate* est;
+  int units;
+  long cuts[MAX_UNITS + 1];   /* unit u gets keys cuts[u] to cuts[u+1] */
+  double time;      /* longest unit's time */
+} split;
+
+/* struct for writing one unit's plan */
+typedef struct unit {
+  int id;
+  frame* frames;
+  long n;
+  point* start;
+  gimbal* gim;
+  int prec;
+  double time;
+  double ymin, ymax, pmin, pmax;
+  int err;
+} unit;
+
+
+/* sort keys: yaw displacement, or pitch level (which is exact where the
+ * pitch displacement is not) */
+int cmpYaw( const void* a, const void* b ) {
+  double x = ((const frame*)a)->d.y, y = ((const frame*)b)->d.y;
+  return ( x > y ) - ( x < y );
+}
+
+int cmpPitch( const void* a, const void* b ) {
+  int x = ((const frame*)a)->level, y = ((const frame*)b)->level;
+  return ( x > y ) - ( x < y );
+}
+
+/* shooting order within a unit: row by row up, yaw across each row */
+int cmpRowYaw( const void* a, const void* b ) {
+  const frame* f = (const frame*)a;
+  const frame* g = (const frame*)b;
+  if( f->level != g->level ) return f->level < g->level ? -1 : 1;
+  return ( f->d.y > g->d.y ) - ( f->d.y < g->d.y );
+}
+
+/* void unitOrder( frames, count )
+ *
+ * Puts one unit's frames in shooting order: rows from the bottom up,
+ * zigzagging so each row starts at the end the last one finished.
+ */
+void unitOrder( frame* f, long n ) {
+  long i, j, k;
+  int row = 0;
+
+  qsort( f, n, sizeof(frame), cmpRowYaw );
+  for( i = 0; i < n; i = j, ++row ) {
+    for( j = i + 1; j < n && f[j].level == f[i].level; ++j )
+      ;
+    if( row % 2 )
+      for( k = 0; k < ( j - i )/2; ++k ) {
+        frame t = f[i+k]; f[i+k] = f[j-1-k]; f[j-1-k] = t;
+      }
+  }
+}
+
+/* double unitTime( frames in shooting order, count, start, gimbal, estimate )
+ *
+ * Predicted time for a unit to shoot its frames, starting pointed at the
+ * first one; the frame count if there is no gimbal model.
+ */
+double unitTime( frame* f, long n, point* start, gimbal* g, estimate* e ) {
+  long i;
+
+  if( !g || !n ) return n;
+  point first = shiftPt( &f[0].d, start );
+  estStart( e, &first );
+  for( i = 0; i < n; ++i )
+    estFrame( e, shiftPt( &f[i].d, start ), g,
+              !i || f[i].level != f[i-1].level );
+  return e->time;
+}
+
+/* double keysTime( split, first key, key past the last )
+ *
+ * Time for one unit to shoot the frames with keys a to b.
+ */
+double keysTime( split* s, long a, long b ) {
+  long n = s->first[b] - s->first[a];
+  memcpy( s->scratch, s->frames + s->first[a], n*sizeof(frame) );
+  unitOrder( s->scratch, n );
+  return unitTime( s->scratch, n, s->start, s->gim, s->est );
+}
+
+/* int cutsFor( split, longest time allowed )
+ *
+ * Gives each unit in turn as many keys as it can shoot in time t (a unit
+ * takes longer the more keys it has, so this is a bisection per unit).
+ * Returns 1 if that covers every key, 0 if not.
+ */
+int cutsFor( split* s, double t ) {
+  long a = 0;
+  int u;
+
+  s->cuts[0] = 0;
+  for( u = 0; u < s->units; ++u ) {
+    long lo = a, hi = s->m;
+
+    /* largest b in [a, m] with keysTime( a, b ) <= t */
+    while( lo < hi ) {
+      long mid = ( lo + hi + 1 )/2;
+      if( keysTime( s, a, mid ) <= t ) lo = mid;
+      else hi = mid - 1;
+    }
+    s->cuts[u+1] = a = lo;
+  }
+  return a == s->m;
+}
+
+/* void* balance( split )
+ *
+ * Thread body: sorts the frames along the split's axis and finds the cuts
+ * that minimize the longest unit's time, by bisection on that time.
+ */
+void* balance( void* arg ) {
+  split* s = (split*)arg;
+  long i;
+  int k;
+
+  qsort( s->frames, s->n, sizeof(frame),
+         s->axis == SPLIT_YAW ? cmpYaw : cmpPitch );
+
+  for( i = 0, s->m = 0; i < s->n; ++i )
+    if( !i || ( s->axis == SPLIT_YAW
+                ? YAW_SAME < s->frames[i].d.y - s->frames[i-1].d.y
+                : s->frames[i].level != s->frames[i-1].level ) )
+      s->first[s->m++] = i;
+  s->first[s->m] = s->n;
+
+  double lo = 0.0, hi = keysTime( s, 0, s->m );
+  for( k = 0; k < BALANCE_STEPS; ++k ) {
+    double t = 0.5*( lo + hi );
+    if( cutsFor( s, t ) ) hi = t; else lo = t;
+  }
+  cutsFor( s, hi );
+
+  for( k = 0, s->time = 0.0; k < s->units; ++k ) {
+    double t = keysTime( s, s->cuts[k], s->cuts[k+1] );
+    if( s->time < t ) s->time = t;
+  }
+  return NULL;
+}
+
+/* void* writeUnit( unit )
+ *
+ * Thread body: orders one unit's frames, predicts its time and writes its
+ * plan file.
+ */
+void* writeUnit( void* arg ) {
+  unit* u = (unit*)arg;
+  char name[64];
+  long i;
+
+  estimate* e = (estimate*)malloc(sizeof(estimate));
+  planw* w = (planw*)malloc(sizeof(planw));
+  snprintf( name, sizeof(name), UNIT_FILE, u->id );
+  FILE* out = fopen( name, "w" );
+
+  if( !e || !w || !out ) { u->err = 1; return NULL; }
+
+  unitOrder( u->frames, u->n );
+  u->time = unitTime( u->frames, u->n, u->start, u->gim, e );
+
+  planwOpen( w, out, u->prec );
+  u->ymin = u->pmin = INFINITY; u->ymax = u->pmax = -INFINITY;
+  for( i = 0; i < u->n; ++i ) {
+    planwPt( w, shiftPt( &u->frames[i].d, u->start ) );
+    u->ymin = fmin( u->ymin, u->frames[i].d.y );
+    u->ymax = fmax( u->ymax, u->frames[i].d.y );
+    u->pmin = fmin( u->pmin, u->frames[i].d.p );
+    u->pmax = fmax( u->pmax, u->frames[i].d.p );
+  }
+  u->err = planwClose( w ) | fclose( out );
+
+  free( e ); free( w );
+  return NULL;
+}
+
+
+int main( int argc, char** argv ) {
+  int units, opt, prec = PLAN_PREC, problem = 0;
+  double flength, sensw, sensh, hover, yover;
+  point start, top_right, bot_left;
+  gimbal gim;
+  gimbal* g = NULL;
+  long i;
+  int u, a;
+
+  if( argc != 15 && argc != 16 ) { usage(); return -1; }
+
+  units     = atoi( argv[1] );
+  flength   = atof( argv[3] );
+  sensw     = atof( argv[4] );
+  sensh     = atof( argv[5] );
+  start.y   = atof( argv[6] );
+  start.p   = atof( argv[7] );
+  top_right.y = atof( argv[8] );
+  bot_left.y  = atof( argv[9] );
+  top_right.p = atof( argv[10] );
+  bot_left.p  = atof( argv[11] );
+  hover     = atof( argv[12] );
+  yover     = atof( argv[13] );
+  opt       = atoi( argv[14] );
+  if( argc == 16 ) prec = atoi( argv[15] );
+
+  /* the same limits gigapan puts on its arguments */
+  if( units < 1 || MAX_UNITS < units ) {
+    fprintf( stderr, "\nUnits needs to be in range [1,%d]\n", MAX_UNITS );
+    ++problem;
+  }
+  if( !( 0.0 < flength && 0.0 < sensw && 0.0 < sensh ) ) {
+    fprintf( stderr, "\nFocal length and sensor size need to be over 0.\n" );
+    ++problem;
+  }
+  if( start.y < MIN_S_Y || MAX_S_Y < start.y || start.p < MIN_S_P ||
+      MAX_S_P < start.p ) {
+    fprintf( stderr, "\nStarting yaw and pitch need to be in %s, %s\n",
+             S_Y_RANGE, S_P_RANGE );
+    ++problem;
+  }
+  if( top_right.y < 0.0 || R_EDGE < top_right.y || bot_left.y < L_EDGE ||
+      0.0 < bot_left.y || top_right.p < 0.0 || TOP_EDGE < top_right.p ||
+      bot_left.p < BOT_EDGE || 0.0 < bot_left.p ) {
+    fprintf( stderr, "\nRight, left, up and down need to be in %s, %s, %s, "
+             "%s\n", R_RANGE, L_RANGE, UP_RANGE, DOWN_RANGE );
+    ++problem;
+  }
+  if( !hoverOk( hover ) || !yoverOk( yover ) ) {
+    fprintf( stderr, "\nOverlaps need to be in %s and %s\n", HOVER_RANGE,
+             YOVER_RANGE );
+    ++problem;
+  }
+  if( prec < PREC_EXACT || PREC_MAX < prec ) {
+    fprintf( stderr, "\nPrecision needs to be %d, or in range [0,%d]\n",
+             PREC_EXACT, PREC_MAX );
+    ++problem;
+  }
+  if( strcmp( argv[2], "-" ) ) {
+    FILE* gimf = fopen( argv[2], "r" );
+    if( !gimf || readGimbal( gimf, &gim ) ) {
+      fprintf( stderr, "\nCould not read a gimbal model from %s\n", argv[2] );
+      ++problem;
+    }
+    if( gimf ) fclose( gimf );
+    g = &gim;
+  }
+  if( problem ) {
+    fprintf( stderr, "\nThere were %d problems total\n", problem );
+    return -1;
+  }
+
+  /* the gigapan itself, laid out as gigapan does it (fields of view
+   * included), and its time for a single platform */
+  double HFOV = fov( sensw, flength );
+  double VFOV = fov( sensh, flength );
+  long n = gridPlan( &start, &top_right, &bot_left, HFOV, VFOV, hover, yover,
+                     opt, NULL, 0 );
+  frame* frames = (frame*)malloc(n*sizeof(frame));
+  estimate* est = (estimate*)malloc(sizeof(estimate));
+
+  if( !frames || !est ) {
+    fprintf( stderr, "\nThere was a problem allocating memory." );
+    return -1;
+  }
+  gridPlan( &start, &top_right, &bot_left, HFOV, VFOV, hover, yover, opt,
+            frames, n );
+
+  double single = n;
+  if( g ) {
+    estStart( est, &start );
+    for( i = 0; i < n; ++i )
+      estFrame( est, shiftPt( &frames[i].d, &start ), g,
+                !i || frames[i].row != frames[i-1].row );
+    single = est->time;
+  }
+
+  /* balance both ways of splitting at once */
+  split splits[2];
+  pthread_t tids[MAX_UNITS];
+
+  for( a = 0; a < 2; ++a ) {
+    split* s = &splits[a];
+    s->axis = a;
+    s->n = n;
+    s->start = &start;
+    s->gim = g;
+    s->units = units;
+    s->frames = (frame*)malloc(n*sizeof(frame));
+    s->scratch = (frame*)malloc(n*sizeof(frame));
+    s->first = (long*)malloc((n + 1)*sizeof(long));
+    s->est = (estimate*)malloc(sizeof(estimate));
+    if( !s->frames || !s->scratch || !s->first || !s->est ) {
+      fprintf( stderr, "\nThere was a problem allocating memory." );
+      return -1;
+    }
+    memcpy( s->frames, frames, n*sizeof(frame) );
+    if( pthread_create( &tids[a], NULL, balance, s ) ) {
+      fprintf( stderr, "\nCould not start a thread\n" );
+      return -1;
+    }
+  }
+  for( a = 0; a < 2; ++a ) pthread_join( tids[a], NULL );
+
+  split* best = splits[SPLIT_PITCH].time < splits[SPLIT_YAW].time
+              ? &splits[SPLIT_PITCH] : &splits[SPLIT_YAW];
+
+  /* write every unit's plan at once */
+  unit us[MAX_UNITS];
+  for( u = 0; u < units; ++u ) {
+    long f0 = best->first[best->cuts[u]], f1 = best->first[best->cuts[u+1]];
+    unit* x = &us[u];
+    x->id = u + 1;
+    x->frames = best->frames + f0;
+    x->n = f1 - f0;
+    x->start = &start;
+    x->gim = g;
+    x->prec = prec;
+    x->err = 0;
+    if( pthread_create( &tids[u], NULL, writeUnit, x ) ) {
+      fprintf( stderr, "\nCould not start a thread\n" );
+      return -1;
+    }
+  }
+
+  double longest = 0.0;
+  long total = 0;
+  int failed = 0;
+  for( u = 0; u < units; ++u ) {
+    pthread_join( tids[u], NULL );
+    failed += us[u].err;
+    total += us[u].n;
+    if( longest < us[u].time ) longest = us[u].time;
+  }
+
+  /* report */
+  const char* unitOf = g ? "s" : "frames";
+  printf( "\nGigapan: %ld frames, %.1f %s on one platform\n", n, single,
+          unitOf );
+  printf( "Split by %s (longest unit %.1f %s; by %s it would be %.1f)\n\n",
+          best->axis == SPLIT_YAW ? "yaw" : "pitch", best->time, unitOf,
+          best->axis == SPLIT_YAW ? "pitch" : "yaw",
+          splits[!best->axis].time );
+  printf( "unit\tframes\tyaw\t\tpitch\t\ttime (%s)\tplan\n", unitOf );
+  for( u = 0; u < units; ++u ) {
+    char name[64];
+    snprintf( name, sizeof(name), UNIT_FILE, us[u].id );
+    if( !us[u].n ) {
+      printf( "%d\t0\t-\t\t-\t\t0.0\t\t%s\n", us[u].id, name );
+      continue;
+    }
+    printf( "%d\t%ld\t%.1f:%.1f\t%.1f:%.1f\t%.1f\t\t%s\n", us[u].id, us[u].n,
+            start.y + us[u].ymin, start.y + us[u].ymax,
+            start.p + us[u].pmin, start.p + us[u].pmax, us[u].time, name );
+  }
+  printf( "\nFleet mission: %.1f %s, %.2fx one platform's speed with %d\n",
+          longest, unitOf, longest ? single/longest : 0.0, units );
+
+  if( total != n ) {
+    fprintf( stderr, "\n%ld of %ld frames assigned\n", total, n );
+    return -1;
+  }
+  if( failed ) {
+    fprintf( stderr, "\nThere was a problem writing the unit plans\n" );
+    return -1;
+  }
+
+  for( a = 0; a < 2; ++a ) {
+    free( splits[a].frames ); free( splits[a].scratch );
+    free( splits[a].first ); free( splits[a].est );
+  }
+  free( frames ); free( est );
+  return 0;
+}
@@ -0,0 +1,313 @@
+/**********************************************
+ * UCSD NGS Stabilized Aerial Camera Platform *
+ * Frame Lookup                               *
+ *                                            *
+ * File: UCSD-E4E/sacp/panorama/frameidx.c    *
+ * Requires ./frameidx.h ./planio.h           *
+ **********************************************/
+
+#include <time.h>
+#include "frameidx.h"
+#include "planio.h"
+
+/* Most frame numbers the benchmark keeps per query (it only counts them) */
+#define MAX_HITS 4096
+
+/* Queries checked against a brute force scan in the benchmark */
+#define BENCH_CHECK 20000
+
+/* Vertices of the benchmark's random polygons */
+#define BENCH_POLY 5
+
+void usage() {
+  puts( "\nframeidx build <plan> <index> <focal length> <sensor width>"       );
+  puts( "                <sensor height>"                                      );
+  puts( "frameidx query <index>"                                               );
+  puts( "frameidx bench <index> <queries> [cone radius]\n"                     );
+  puts( "build: indexes the frames in a plan (coords.txt from gigapan, or"     );
+  puts( "       achieved yaw/pitch attitudes in the same format), each seeing" );
+  puts( "       the field of view of the given lens and sensor."              );
+  puts( "query: answers one query per line of stdin with the numbers (from 0," );
+  puts( "       in plan order) of the frames that see it:"                     );
+  puts( "         p <yaw> <pitch>                  a direction"                );
+  puts( "         c <yaw> <pitch> <radius>         any part of a cone"         );
+  puts( "         g <east> <north> <height>        a ground point, meters"    );
+  puts( "         P <yaw> <pitch> <yaw> <pitch>... any part of a polygon"      );
+  puts( "       Angles are in degrees. Bad queries, polygons of more than 64"  );
+  puts( "       vertices among them, get a line with just ?"                   );
+  puts( "bench: times random point, cone (default radius 1 degree) and"        );
+  puts( "       polygon queries (vertices as far out as the cone radius), and"  );
+  puts( "       checks a sample of them against a brute force scan."           );
+}
+
+int cmpU32( const void* a, const void* b ) {
+  uint32_t x = *(const uint32_t*)a, y = *(const uint32_t*)b;
+  return ( x > y ) - ( x < y );
+}
+
+double seconds() {
+  struct timespec ts;
+  clock_gettime( CLOCK_MONOTONIC, &ts );
+  return ts.tv_sec + 1e-9*ts.tv_nsec;
+}
+
+
+/* int build( plan file, index file, focal length, sensor width, height ) */
+int build( const char* plan, const char* index, double f, double w,
+           double h ) {
+  FILE* in = fopen( plan, "r" );
+  long n = 0, cap = 1024;
+  point* pts = (point*)malloc( cap*sizeof(point) );
+  planr* r = (planr*)malloc( sizeof(planr) );
+  int got;
+
+  if( !( 0.0 < f && 0.0 < w && 0.0 < h ) ) {
+    fprintf( stderr, "\nFocal length and sensor size must be over 0.\n" );
+    return -1;
+  }
+
+  if( !in || !pts || !r ) {
+    fprintf( stderr, "\nCould not read plan %s\n", plan );
+    return -1;
+  }
+
+  planrOpen( r, in );
+  while( ( got = planrPt( r, &pts[n] ) ) == 1 ) {
+    if( ++n == cap ) {
+      point* grown = (point*)realloc( pts, 2*cap*sizeof(point) );
+      if( !grown ) {
+        fprintf( stderr, "There was a problem allocating memory." );
+        return -1;
+      }
+      pts = grown; cap *= 2;
+    }
+  }
+  fclose( in );
+  free( r );
+
+  if( got < 0 ) {
+    fprintf( stderr, "\n%s is not a plan after frame %ld\n", plan, n );
+    return -1;
+  }
+
+  FILE* out = fopen( index, "wb" );
+  if( !out || fixWrite( out, pts, n, fov( f, w ), fov( f, h ) ) ||
+      fclose( out ) ) {
+    fprintf( stderr, "\nCould not write index %s\n", index );
+    return -1;
+  }
+
+  printf( "Indexed %ld frames, %.1f x %.1f degrees each\n", n, fov( f, w ),
+          fov( f, h ) );
+  free( pts );
+  return 0;
+}
+
+/* int query( index file )
+ *
+ * Answers the queries on stdin, one output line per input line. Every
+ * frame that matches is printed, however many there are.
+ */
+int query( const char* index ) {
+  fix x;
+  uint32_t* hits;
+  point poly[MAX_POLY];
+  char line[4096];
+
+  if( fixOpen( index, &x ) ) {
+    fprintf( stderr, "\nCould not open index %s\n", index );
+    return -1;
+  }
+
+  /* room for every frame, so no answer is ever cut short */
+  long max = x.head->nframes;
+  hits = (uint32_t*)malloc( ( max + 1 )*sizeof(uint32_t) );
+  if( !hits ) {
+    fprintf( stderr, "There was a problem allocating memory." );
+    return -1;
+  }
+
+  while( fgets( line, sizeof(line), stdin ) ) {
+    char* s = line + 1;
+    char* e;
+    double a[3];
+    long n = -1, i;
+    int k = 0;
+    vec d;
+
+    /* a line too long to read whole is one bad query, not several */
+    if( !strchr( line, '\n' ) && !feof( stdin ) ) {
+      int c;
+      while( ( c = getchar() ) != '\n' && c != EOF );
+      puts( "?" );
+      continue;
+    }
+
+    /* up to 2*MAX_POLY numbers after the query letter; any more and the
+     * query is bad rather than cut short */
+    while( k < 2*MAX_POLY ) {
+      double v = strtod( s, &e );
+      if( e == s ) break;
+      if( k < 3 ) a[k] = v;
+      if( k % 2 ) poly[k/2].p = v; else poly[k/2].y = v;
+      ++k; s = e;
+    }
+    strtod( s, &e );
+    if( e != s ) k = -1;
+
+    switch( line[0] ) {
+      case 'p':
+        if( k != 2 ) break;
+        dirVec( a[0], a[1], d );
+        n = fixPoint( &x, d, hits, max );
+        break;
+      case 'c':
+        if( k != 3 ) break;
+        dirVec( a[0], a[1], d );
+        n = fixCone( &x, d, deg2rad*a[2], hits, max );
+        break;
+      case 'g':
+        if( k != 3 || !( 0.0 < a[2] ) ) break;
+        groundDir( a[0], a[1], a[2], d );
+        n = fixPoint( &x, d, hits, max );
+        break;
+      case 'P':
+        if( k < 0 || k % 2 ) break;
+        n = fixPolygon( &x, poly, k/2, hits, max );
+        break;
+    }
+
+    if( n < 0 ) { puts( "?" ); continue; }
+
+    /* cones and polygons find frames in cell order */
+    qsort( hits, n, sizeof(uint32_t), cmpU32 );
+    for( i = 0; i < n; ++i ) printf( i ? " %u" : "%u", hits[i] );
+    putchar( '\n' );
+  }
+
+  fixClose( &x );
+  free( hits );
+  return 0;
+}
+
+/* void benchPoly( center, radius (radians), vertices to fill in )
+ *
+ * A random polygon of BENCH_POLY vertices around the center, each at
+ * between half and all of the radius from it, in order of bearing so the
+ * polygon is simple but usually not convex.
+ */
+void benchPoly( const vec c, double r, point* pts ) {
+  fixframe f;
+  int i, k;
+
+  frameSet( &f, rad2deg*atan2( c[1], c[0] ),
+            rad2deg*asin( fmax( -1.0, fmin( 1.0, c[2] ) ) ) );
+  for( i = 0; i < BENCH_POLY; ++i ) {
+    double a = 2.0*pi*( i + 0.8*rand()/RAND_MAX )/BENCH_POLY;
+    double d = r*( 0.5 + 0.5*rand()/RAND_MAX );
+    vec v;
+    for( k = 0; k < 3; ++k )
+      v[k] = cos( d )*f.axis[k] +
+             sin( d )*( cos( a )*f.right[k] + sin( a )*f.up[k] );
+    pts[i].y = rad2deg*atan2( v[1], v[0] );
+    pts[i].p = rad2deg*asin( fmax( -1.0, fmin( 1.0, v[2] ) ) );
+  }
+}
+
+/* int bench( index file, number of queries, cone radius in degrees )
+ *
+ * Random directions, uniform over the sphere. Point, cone and polygon
+ * queries are timed separately, and the first BENCH_CHECK of each are
+ * compared with testing every frame.
+ */
+int bench( const char* index, long nq, double radius ) {
+  fix x;
+  uint32_t hits[MAX_HITS];
+  long i, total, bad = 0;
+  vec* dirs = (vec*)malloc( nq*sizeof(vec) );
+  point* polys = (point*)malloc( nq*BENCH_POLY*sizeof(point) );
+
+  if( !( 0.0 <= radius && radius < 90.0 ) ) {
+    fprintf( stderr, "\nCone radius must be in [0,90)\n" );
+    return -1;
+  }
+
+  if( fixOpen( index, &x ) || !dirs || !polys ) {
+    fprintf( stderr, "\nCould not open index %s\n", index );
+    return -1;
+  }
+
+  srand( 1 );
+  for( i = 0; i < nq; ++i )
+    dirVec( 360.0*rand()/RAND_MAX - 180.0,
+            rad2deg*asin( 2.0*rand()/RAND_MAX - 1.0 ), dirs[i] );
+  for( i = 0; i < nq; ++i )
+    benchPoly( dirs[i], deg2rad*radius, polys + i*BENCH_POLY );
+
+  printf( "%u frames, %u x %u cells, %ld queries\n", x.head->nframes,
+          x.head->nb, x.head->ns, nq );
+
+  double t = seconds();
+  for( i = total = 0; i < nq; ++i )
+    total += fixPoint( &x, dirs[i], hits, MAX_HITS );
+  t = seconds() - t;
+  printf( "point: %.3f s, %.0f queries/s, %.3f us/query, %.2f hits/query\n",
+          t, nq/t, 1e6*t/nq, (double)total/nq );
+
+  t = seconds();
+  for( i = total = 0; i < nq; ++i )
+    total += fixCone( &x, dirs[i], deg2rad*radius, hits, MAX_HITS );
+  t = seconds() - t;
+  printf( "cone:  %.3f s, %.0f queries/s, %.3f us/query, %.2f hits/query\n",
+          t, nq/t, 1e6*t/nq, (double)total/nq );
+
+  t = seconds();
+  for( i = total = 0; i < nq; ++i )
+    total += fixPolygon( &x, polys + i*BENCH_POLY, BENCH_POLY, hits, MAX_HITS );
+  t = seconds() - t;
+  printf( "poly:  %.3f s, %.0f queries/s, %.3f us/query, %.2f hits/query\n",
+          t, nq/t, 1e6*t/nq, (double)total/nq );
+
+  /* brute force check */
+  fixcone k;
+  fixpoly g;
+  for( i = 0; i < nq && i < BENCH_CHECK; ++i ) {
+    long np = fixPoint( &x, dirs[i], hits, MAX_HITS );
+    long nc = fixCone( &x, dirs[i], deg2rad*radius, hits, MAX_HITS );
+    long ng = fixPolygon( &x, polys + i*BENCH_POLY, BENCH_POLY, hits,
+                          MAX_HITS );
+    long bp = 0, bc = 0, bg = 0;
+    uint32_t f;
+
+    coneSet( &k, dirs[i], deg2rad*radius, x.head );
+    if( polySet( &g, polys + i*BENCH_POLY, BENCH_POLY, x.head ) ) bg = -1;
+    for( f = 0; f < x.head->nframes; ++f ) {
+      bp += frameSees( &x.frames[f], x.head, dirs[i] );
+      bc += coneHits( &x.frames[f], x.head, &k );
+      if( 0 <= bg ) bg += polyHits( &x.frames[f], x.head, &g );
+    }
+    bad += ( np != bp ) + ( nc != bc ) + ( ng != bg );
+  }
+  printf( "checked %ld point, cone and polygon queries against a full scan: "
+          "%ld mismatches\n", i, bad );
+
+  fixClose( &x );
+  free( dirs ); free( polys );
+  return bad ? -1 : 0;
+}
+
+
+int main( int argc, char** argv ) {
+  if( argc == 7 && !strcmp( argv[1], "build" ) )
+    return build( argv[2], argv[3], atof( argv[4] ), atof( argv[5] ),
+                  atof( argv[6] ) );
+
+  if( argc == 3 && !strcmp( argv[1], "query" ) )
+    return query( argv[2] );
+
+  if( ( argc == 4 || argc == 5 ) && !strcmp( argv[1], "bench" ) )
+    return bench( argv[2], atol( argv[3] ), argc == 5 ? atof( argv[4] ) : 1.0 );
+
+  usage();
+  return -1;
+}
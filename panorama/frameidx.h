@@ -0,0 +1,577 @@
+#ifndef FRAMEIDX
+#define FRAMEIDX
+
+/**********************************************
+ * UCSD E4E Stabilized Aerial Camera Platform *
+ * Panorama                                   *
+ *                                            *
+ * File: UCSD-E4E/sacp/panorama/frameidx.h    *
+ * Requires ./gigapan.h                       *
+ *                                            *
+ * Compatibility: C99, POSIX (mmap)           *
+ **********************************************/
+
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "gigapan.h"
+
+/***************Spherical index of captured frames********************
+ *
+ * Every frame is a camera pointed at (yaw, pitch) with no roll, seeing the
+ * spherical rectangle whose edges are the great circles through the sides
+ * of its sensor. The sphere is cut into equal-area cells: NB bands of equal
+ * height in z = sin(pitch), each cut into NS equal yaw sectors. A frame is
+ * listed in every cell its bounding cap (the smallest cone around its
+ * axis holding the whole rectangle) touches, so a query only ever tests the
+ * frames listed in the cells it touches, and then tests them exactly.
+ *
+ * The index file is laid out so it can be used straight from mmap():
+ *   fixhead, fixframe[nframes], uint32 cellstart[ncells+1], uint32 list[]
+ * with cell c's frames at list[cellstart[c]] .. list[cellstart[c+1]-1].
+ *
+ * DEPENDS ON SPECIFIC IMU SPHERE PARAMETRIZATION
+ */
+
+#define FIX_MAGIC "SACPFIX1"
+
+/* Finest cell size, degrees; cells are otherwise about half a frame */
+#define MIN_CELL 0.5
+
+/* Most vertices in a polygon query */
+#define MAX_POLY 64
+
+typedef double vec[3];
+
+/* struct at the start of an index file */
+typedef struct fixhead {
+  char     magic[8];
+  uint32_t nframes;
+  uint32_t nb, ns;          /* bands, sectors per band */
+  uint32_t pad;
+  double   tx, ty;          /* tan(hfov/2), tan(vfov/2) */
+  double   radius;          /* bounding cap radius of a frame, radians */
+} fixhead;
+
+/* struct for one frame: where it points, and its image plane axes */
+typedef struct fixframe {
+  double y, p;              /* yaw, pitch, degrees */
+  vec axis, right, up;
+} fixframe;
+
+/* struct for an open (mapped) index and per-query scratch space */
+typedef struct fix {
+  const fixhead*  head;
+  const fixframe* frames;
+  const uint32_t* start;
+  const uint32_t* list;
+  void*           map;
+  size_t          maplen;
+  uint32_t*       seen;     /* per frame: last query that tested it */
+  uint32_t        query;
+} fix;
+
+
+/* Unit sphere helpers */
+void dirVec( double y, double p, vec v ) {
+  v[0] = cos( deg2rad*p )*cos( deg2rad*y );
+  v[1] = cos( deg2rad*p )*sin( deg2rad*y );
+  v[2] = sin( deg2rad*p );
+}
+
+double dot( const vec a, const vec b ) {
+  return a[0]*b[0] + a[1]*b[1] + a[2]*b[2];
+}
+
+void cross( const vec a, const vec b, vec c ) {
+  c[0] = a[1]*b[2] - a[2]*b[1];
+  c[1] = a[2]*b[0] - a[0]*b[2];
+  c[2] = a[0]*b[1] - a[1]*b[0];
+}
+
+void normalize( vec a ) {
+  double n = sqrt( dot( a, a ) );
+  if( 0.0 < n ) { a[0] /= n; a[1] /= n; a[2] /= n; }
+}
+
+/* Angle between unit vectors, radians (atan2 keeps small angles exact) */
+double angle( const vec a, const vec b ) {
+  vec c;
+  cross( a, b, c );
+  return atan2( sqrt( dot( c, c ) ), dot( a, b ) );
+}
+
+/* void frameSet( frame, yaw, pitch )
+ *
+ * Fills in the frame's axis and its image plane's right and up directions
+ * (right is along increasing yaw, up along increasing pitch).
+ */
+void frameSet( fixframe* f, double y, double p ) {
+  f->y = y; f->p = p;
+  dirVec( y, p, f->axis );
+  f->right[0] = -sin( deg2rad*y );
+  f->right[1] = cos( deg2rad*y );
+  f->right[2] = 0.0;
+  f->up[0] = -sin( deg2rad*p )*cos( deg2rad*y );
+  f->up[1] = -sin( deg2rad*p )*sin( deg2rad*y );
+  f->up[2] = cos( deg2rad*p );
+}
+
+/* int frameSees( frame, index header, unit direction )
+ *
+ * Exact test of whether a direction falls inside the frame.
+ */
+int frameSees( const fixframe* f, const fixhead* h, const vec d ) {
+  double z = dot( d, f->axis );
+  if( z <= 0.0 ) return 0;
+  return fabs( dot( d, f->right ) ) <= h->tx*z &&
+         fabs( dot( d, f->up ) ) <= h->ty*z;
+}
+
+/* void frameCorners( frame, index header, corners )
+ *
+ * Unit vectors to the 4 corners, in order around the rectangle.
+ */
+void frameCorners( const fixframe* f, const fixhead* h, vec c[4] ) {
+  static const double su[4] = { -1, 1, 1, -1 }, sv[4] = { -1, -1, 1, 1 };
+  int i, k;
+  for( i = 0; i < 4; ++i ) {
+    for( k = 0; k < 3; ++k )
+      c[i][k] = f->axis[k] + su[i]*h->tx*f->right[k] + sv[i]*h->ty*f->up[k];
+    normalize( c[i] );
+  }
+}
+
+/* int arcWithin( unit direction, arc start, arc end, cos r, sin r )
+ *
+ * Whether a direction is within angle r (r < 90 degrees) of the shorter
+ * great circle arc between two unit vectors. Works on sines and cosines
+ * so the inner loop of a cone query needs no inverse trig.
+ */
+int arcWithin( const vec d, const vec a, const vec b, double cosr,
+               double sinr ) {
+  vec n, an, nb;
+  cross( a, b, n );
+  normalize( n );
+
+  /* foot of the perpendicular is on the arc if d is between a and b */
+  cross( a, d, an ); cross( d, b, nb );
+  if( 0.0 <= dot( an, n ) && 0.0 <= dot( nb, n ) )
+    return 0.0 < dot( d, a ) + dot( d, b ) && fabs( dot( d, n ) ) <= sinr;
+
+  return cosr <= dot( d, a ) || cosr <= dot( d, b );
+}
+
+
+/* void capCells( index header, unit center, radius (radians),
+ *                callback, callback argument )
+ *
+ * Calls back with every cell the cap of the given radius around center
+ * touches (some cells it doesn't touch, near the cap's corners, too).
+ */
+void capCells( const fixhead* h, const vec c, double r,
+               void (*cb)( uint32_t cell, void* arg ), void* arg ) {
+  /* a hair of slack so rounding never loses a cell on a boundary */
+  r += 1e-9;
+
+  double p = rad2deg*asin( fmax( -1.0, fmin( 1.0, c[2] ) ) );
+  double y = rad2deg*atan2( c[1], c[0] );
+  double rd = rad2deg*r;
+
+  double zlo = sin( deg2rad*fmax( -90.0, p - rd ) );
+  double zhi = sin( deg2rad*fmin( 90.0, p + rd ) );
+  long blo = (long)( 0.5*( zlo + 1.0 )*h->nb );
+  long bhi = (long)( 0.5*( zhi + 1.0 )*h->nb );
+  if( (long)h->nb <= bhi ) bhi = h->nb - 1;
+
+  /* yaw half width of the cap, all the way round if it holds a pole */
+  long slo = 0, shi = h->ns - 1;
+  if( fabs( p ) + rd < 90.0 ) {
+    double dy = rad2deg*asin( fmin( 1.0, sin( r )/cos( deg2rad*p ) ) );
+    if( dy < 180.0 ) {
+      slo = (long)floor( ( y - dy + 180.0 )/360.0*h->ns );
+      shi = (long)floor( ( y + dy + 180.0 )/360.0*h->ns );
+      if( (long)h->ns <= shi - slo ) { slo = 0; shi = h->ns - 1; }
+    }
+  }
+
+  long b, s;
+  for( b = blo; b <= bhi; ++b )
+    for( s = slo; s <= shi; ++s )
+      cb( b*h->ns + ( ( s % (long)h->ns ) + h->ns ) % h->ns, arg );
+}
+
+/* Callback arguments for building the cell lists */
+typedef struct fixbuild {
+  uint32_t* count;
+  uint32_t* list;
+  uint32_t  frame;
+} fixbuild;
+
+void countCell( uint32_t cell, void* arg ) {
+  ((fixbuild*)arg)->count[cell]++;
+}
+
+void fillCell( uint32_t cell, void* arg ) {
+  fixbuild* b = (fixbuild*)arg;
+  b->list[b->count[cell]++] = b->frame;
+}
+
+/* int fixWrite( output file, frame yaws and pitches, count,
+ *               horizontal fov, vertical fov )
+ *
+ * Builds the index for the frames (fields of view in degrees) and writes
+ * it out.
+ *
+ * Returns 0 on success, -1 on failure.
+ */
+int fixWrite( FILE* out, const point* pts, uint32_t n, double hfov,
+              double vfov ) {
+  fixhead h;
+  uint32_t i;
+
+  memset( &h, 0, sizeof(h) );
+  memcpy( h.magic, FIX_MAGIC, 8 );
+  h.nframes = n;
+  h.tx = tan( 0.5*deg2rad*hfov );
+  h.ty = tan( 0.5*deg2rad*vfov );
+  h.radius = atan( sqrt( h.tx*h.tx + h.ty*h.ty ) );
+
+  /* cells about half the smaller fov across at the equator */
+  double cell = 0.5*( hfov < vfov ? hfov : vfov );
+  if( cell < MIN_CELL ) cell = MIN_CELL;
+  h.nb = (uint32_t)ceil( 2.0/( deg2rad*cell ) );
+  h.ns = (uint32_t)ceil( 360.0/cell );
+
+  size_t ncells = (size_t)h.nb*h.ns;
+  fixframe* frames = (fixframe*)malloc( n*sizeof(fixframe) + 1 );
+  uint32_t* start = (uint32_t*)calloc( ncells + 1, sizeof(uint32_t) );
+  fixbuild b = { start + 1, NULL, 0 };
+  if( !frames || !start ) { free( frames ); free( start ); return -1; }
+
+  /* count, then fill each cell's list (compressed sparse rows) */
+  for( i = 0; i < n; ++i ) {
+    frameSet( &frames[i], pts[i].y, pts[i].p );
+    capCells( &h, frames[i].axis, h.radius, countCell, &b );
+  }
+  for( i = 0; i < ncells; ++i ) start[i+1] += start[i];
+
+  b.list = (uint32_t*)malloc( start[ncells]*sizeof(uint32_t) + 1 );
+  b.count = start;
+  if( !b.list ) { free( frames ); free( start ); return -1; }
+  for( i = 0; i < n; ++i ) {
+    b.frame = i;
+    capCells( &h, frames[i].axis, h.radius, fillCell, &b );
+  }
+
+  /* filling moved every start up to the next one's */
+  memmove( start + 1, start, ncells*sizeof(uint32_t) );
+  start[0] = 0;
+
+  int bad = fwrite( &h, sizeof(h), 1, out ) != 1 ||
+            fwrite( frames, sizeof(fixframe), n, out ) != n ||
+            fwrite( start, sizeof(uint32_t), ncells + 1, out ) != ncells + 1 ||
+            fwrite( b.list, sizeof(uint32_t), start[ncells], out )
+              != start[ncells];
+
+  free( frames ); free( start ); free( b.list );
+  return bad ? -1 : 0;
+}
+
+/* int fixOpen( index file name, index to fill in )
+ *
+ * Maps an index file read-only. Returns 0 on success, -1 on failure.
+ */
+int fixOpen( const char* path, fix* x ) {
+  struct stat st;
+  int fd = open( path, O_RDONLY );
+
+  if( fd < 0 ) return -1;
+  if( fstat( fd, &st ) || (size_t)st.st_size < sizeof(fixhead) ) {
+    close( fd ); return -1;
+  }
+
+  x->maplen = st.st_size;
+  x->map = mmap( NULL, x->maplen, PROT_READ, MAP_SHARED, fd, 0 );
+  close( fd );
+  if( x->map == MAP_FAILED ) return -1;
+
+  x->head = (const fixhead*)x->map;
+  const fixhead* h = x->head;
+  size_t ncells = (size_t)h->nb*h->ns;
+  size_t need = sizeof(fixhead) + h->nframes*sizeof(fixframe) +
+                ( ncells + 1 )*sizeof(uint32_t);
+
+  if( memcmp( h->magic, FIX_MAGIC, 8 ) || x->maplen < need ) {
+    munmap( x->map, x->maplen ); return -1;
+  }
+
+  x->frames = (const fixframe*)( h + 1 );
+  x->start = (const uint32_t*)( x->frames + h->nframes );
+  x->list = x->start + ncells + 1;
+  if( x->maplen < need + x->start[ncells]*sizeof(uint32_t) ) {
+    munmap( x->map, x->maplen ); return -1;
+  }
+
+  x->seen = (uint32_t*)calloc( h->nframes + 1, sizeof(uint32_t) );
+  x->query = 0;
+  if( !x->seen ) { munmap( x->map, x->maplen ); return -1; }
+  return 0;
+}
+
+void fixClose( fix* x ) {
+  munmap( x->map, x->maplen );
+  free( x->seen );
+}
+
+
+/* long fixPoint( index, unit direction, output frame numbers, max output )
+ *
+ * Frames that see the direction, in frame order. Only the direction's own
+ * cell needs looking at.
+ *
+ * Returns how many there are (more than max means some were left out).
+ */
+long fixPoint( fix* x, const vec d, uint32_t* out, long max ) {
+  const fixhead* h = x->head;
+  long b = (long)( 0.5*( d[2] + 1.0 )*h->nb );
+  long s = (long)floor( ( rad2deg*atan2( d[1], d[0] ) + 180.0 )/360.0*h->ns );
+  long n = 0;
+  uint32_t i;
+
+  if( (long)h->nb <= b ) b = h->nb - 1;
+  if( (long)h->ns <= s ) s = 0;
+
+  uint32_t cell = b*h->ns + s;
+  for( i = x->start[cell]; i < x->start[cell+1]; ++i ) {
+    uint32_t f = x->list[i];
+    if( frameSees( &x->frames[f], h, d ) ) {
+      if( n < max ) out[n] = f;
+      ++n;
+    }
+  }
+  return n;
+}
+
+/* struct for collecting the frames found by a cone or polygon query */
+typedef struct fixhits {
+  fix*      x;
+  int     (*test)( const fixframe* f, const fixhead* h, const void* q );
+  const void* q;
+  uint32_t* out;
+  long      max, n;
+} fixhits;
+
+/* Tests every not yet seen frame in the cell against the query */
+void hitCell( uint32_t cell, void* arg ) {
+  fixhits* k = (fixhits*)arg;
+  fix* x = k->x;
+  uint32_t i;
+
+  for( i = x->start[cell]; i < x->start[cell+1]; ++i ) {
+    uint32_t f = x->list[i];
+    if( x->seen[f] == x->query ) continue;
+    x->seen[f] = x->query;
+    if( k->test( &x->frames[f], x->head, k->q ) ) {
+      if( k->n < k->max ) k->out[k->n] = f;
+      ++k->n;
+    }
+  }
+}
+
+/* Starts a new query's de-duplication round */
+void fixNext( fix* x ) {
+  if( !++x->query ) {
+    memset( x->seen, 0, x->head->nframes*sizeof(uint32_t) );
+    x->query = 1;
+  }
+}
+
+/* struct for a cone query */
+typedef struct fixcone {
+  vec c;
+  double r;        /* radians, under 90 degrees */
+  double cosr, sinr;
+  double cosfar;   /* cos of the farthest a frame's axis can be */
+} fixcone;
+
+/* void coneSet( cone, unit center, radius (radians), index header ) */
+void coneSet( fixcone* k, const vec c, double r, const fixhead* h ) {
+  memcpy( k->c, c, sizeof(vec) );
+  k->r = r;
+  k->cosr = cos( r ); k->sinr = sin( r );
+  k->cosfar = h->radius + r < pi ? cos( h->radius + r ) : -1.0;
+}
+
+/* Exact test: the cone reaches the frame if its center is inside it, or
+ * it comes within r of one of the frame's edges */
+int coneHits( const fixframe* f, const fixhead* h, const void* q ) {
+  const fixcone* k = (const fixcone*)q;
+  vec c[4];
+  int i;
+
+  double cosax = dot( f->axis, k->c );
+  if( cosax < k->cosfar ) return 0;
+  if( k->cosr <= cosax || frameSees( f, h, k->c ) ) return 1;
+
+  frameCorners( f, h, c );
+  for( i = 0; i < 4; ++i )
+    if( arcWithin( k->c, c[i], c[( i + 1 ) % 4], k->cosr, k->sinr ) )
+      return 1;
+  return 0;
+}
+
+/* long fixCone( index, unit center, radius (radians), output, max output )
+ *
+ * Frames that see any part of the cone. Same return as fixPoint(), or -1
+ * if the radius isn't under 90 degrees.
+ */
+long fixCone( fix* x, const vec c, double r, uint32_t* out, long max ) {
+  fixcone k;
+  fixhits hits = { x, coneHits, &k, out, max, 0 };
+
+  if( !( 0.0 <= r && r < 0.5*pi ) ) return -1;
+
+  coneSet( &k, c, r, x->head );
+  fixNext( x );
+  capCells( x->head, c, r, hitCell, &hits );
+  return hits.n;
+}
+
+/* struct for a polygon query: vertices in order, edges are great circle
+ * arcs, and it must fit in a cap smaller than a hemisphere */
+typedef struct fixpoly {
+  int n;
+  vec v[MAX_POLY];
+  vec c;          /* bounding cap center */
+  double r;       /* and radius */
+  double cosfar;  /* cos of the farthest a frame's axis can be */
+} fixpoly;
+
+/* Segment from (ax,ay) to (bx,by) touches the box |x| <= tx, |y| <= ty?
+ * (Liang-Barsky clipping) */
+int segBox( double ax, double ay, double bx, double by, double tx,
+            double ty ) {
+  double t0 = 0.0, t1 = 1.0;
+  double p[4] = { -( bx - ax ), bx - ax, -( by - ay ), by - ay };
+  double q[4] = { ax + tx, tx - ax, ay + ty, ty - ay };
+  int i;
+
+  for( i = 0; i < 4; ++i ) {
+    if( p[i] == 0.0 ) { if( q[i] < 0.0 ) return 0; continue; }
+    double t = q[i]/p[i];
+    if( p[i] < 0.0 ) { if( t1 < t ) return 0; if( t0 < t ) t0 = t; }
+    else             { if( t < t0 ) return 0; if( t < t1 ) t1 = t; }
+  }
+  return 1;
+}
+
+/* Polygon parts closer than this to the plane through the camera square
+ * to its axis (z = 0: beside or behind it) are clipped off before
+ * projecting; what is left near the cut projects far outside any frame */
+#define POLY_NEAR 1e-9
+
+/* Exact test, done in the frame's own image plane (gnomonic projection,
+ * where its edges and the polygon's are all straight lines): some polygon
+ * edge touches the frame's rectangle, or the rectangle is inside the
+ * polygon. The great circle edges are the directions of the straight
+ * chords between vertices, so clipping the chords to z >= POLY_NEAR
+ * (Sutherland-Hodgman) leaves just the part of the polygon in front of the
+ * camera, at the cost of at most one extra vertex per edge. */
+int polyHits( const fixframe* f, const fixhead* h, const void* q ) {
+  const fixpoly* k = (const fixpoly*)q;
+  double px[2*MAX_POLY], py[2*MAX_POLY], z[MAX_POLY];
+  int i, j, n = 0, in = 0;
+
+  if( dot( f->axis, k->c ) < k->cosfar ) return 0;
+
+  for( i = 0; i < k->n; ++i ) z[i] = dot( k->v[i], f->axis );
+
+  for( i = 0, j = k->n - 1; i < k->n; j = i++ ) {
+    /* where the chord from j to i crosses z = POLY_NEAR, if it does */
+    if( ( POLY_NEAR <= z[j] ) != ( POLY_NEAR <= z[i] ) ) {
+      double u = ( POLY_NEAR - z[j] )/( z[i] - z[j] );
+      vec c;
+      c[0] = k->v[j][0] + u*( k->v[i][0] - k->v[j][0] );
+      c[1] = k->v[j][1] + u*( k->v[i][1] - k->v[j][1] );
+      c[2] = k->v[j][2] + u*( k->v[i][2] - k->v[j][2] );
+      px[n] = dot( c, f->right )/POLY_NEAR;
+      py[n] = dot( c, f->up )/POLY_NEAR;
+      ++n;
+    }
+    if( POLY_NEAR <= z[i] ) {
+      px[n] = dot( k->v[i], f->right )/z[i];
+      py[n] = dot( k->v[i], f->up )/z[i];
+      ++n;
+    }
+  }
+  if( !n ) return 0;
+
+  for( i = 0, j = n - 1; i < n; j = i++ ) {
+    if( segBox( px[j], py[j], px[i], py[i], h->tx, h->ty ) ) return 1;
+    /* crossing count for the frame's center, (0,0) */
+    if( ( 0.0 < py[i] ) != ( 0.0 < py[j] ) &&
+        0.0 < px[j] + ( 0.0 - py[j] )*( px[i] - px[j] )/( py[i] - py[j] ) )
+      in = !in;
+  }
+  return in;
+}
+
+/* int polySet( polygon, vertices (yaw, pitch), count, index header )
+ *
+ * Fills in a polygon query. Returns 0, or -1 if the polygon is too big (or
+ * has too many vertices).
+ */
+int polySet( fixpoly* k, const point* pts, int n, const fixhead* h ) {
+  int i;
+
+  if( n < 3 || MAX_POLY < n ) return -1;
+
+  k->n = n;
+  k->c[0] = k->c[1] = k->c[2] = 0.0;
+  for( i = 0; i < n; ++i ) {
+    dirVec( pts[i].y, pts[i].p, k->v[i] );
+    k->c[0] += k->v[i][0]; k->c[1] += k->v[i][1]; k->c[2] += k->v[i][2];
+  }
+  normalize( k->c );
+
+  k->r = 0.0;
+  for( i = 0; i < n; ++i )
+    if( k->r < angle( k->c, k->v[i] ) ) k->r = angle( k->c, k->v[i] );
+  if( 0.5*pi <= k->r ) return -1;
+  k->cosfar = h->radius + k->r < pi ? cos( h->radius + k->r ) : -1.0;
+  return 0;
+}
+
+/* long fixPolygon( index, polygon (yaw, pitch vertices), count, output,
+ *                  max output )
+ *
+ * Frames that see any part of the polygon. Same return as fixPoint(), or
+ * -1 if the polygon is too big (or has too many vertices).
+ */
+long fixPolygon( fix* x, const point* pts, int n, uint32_t* out, long max ) {
+  fixpoly k;
+  fixhits hits = { x, polyHits, &k, out, max, 0 };
+
+  if( polySet( &k, pts, n, x->head ) ) return -1;
+
+  fixNext( x );
+  capCells( x->head, k.c, k.r, hitCell, &hits );
+  return hits.n;
+}
+
+/* void groundDir( east, north, platform height, direction )
+ *
+ * Direction from the platform to a point on flat ground, given in meters
+ * east and north of the point right below it. Takes yaw to be the IMU's
+ * heading: 0 north, increasing towards east.
+ */
+void groundDir( double east, double north, double height, vec d ) {
+  double y = rad2deg*atan2( east, north );
+  double p = -rad2deg*atan2( height, sqrt( east*east + north*north ) );
+  dirVec( y, p, d );
+}
+
+#endif /* FRAMEIDX */
@@ -3,7 +3,7 @@
  * Gigapan Coordinate Generator               *
  *                                            *
  * File: UCSD-E4E/sacp/panorama/gigapan.c     *
- * Requires ./gigapan.h                       *
+ * Requires ./gigapan.h ./planio.h            *
  *                                            *
  * Author: Sergei I. Radutnuy                 *
  *         sradutnu@ucsd.edu                  *
@@ -11,7 +11,7 @@
  * Last Modified: May 7 2013                  *
  **********************************************/
 
-#include "gigapan.h"
+#include "planio.h"
 
 void usage() {
   puts( "\nTo enter command line arguments and skip dialog:\n" );
@@ -19,10 +19,15 @@ void usage() {
   puts( "gigapan <focal length> <sensor width> <sensor height>"    );
   puts( "        <start yaw> <start pitch> <how right> <how left>" );
   puts( "        <how up> <how down> <horizontal overlap>"         );
-  puts( "        <vertical overlap>\n"                             );
-
-  printf( "There should be 12 arguments total, and this message will be\n " );
-  printf( "printed again if there is an error in any of them.\n"            );
+  puts( "        <vertical overlap> <optimize>"                     );
+  puts( "        [gimbal model file [precision]]\n"                 );
+
+  printf( "There should be 12 arguments total, plus an optional gimbal\n"   );
+  printf( "model file for a mission time estimate (- for none) and the\n"   );
+  printf( "number of decimal places for coordinates (default %d, %d for\n",
+          PLAN_PREC, PREC_EXACT                                             );
+  printf( "full precision), and this message will be printed again if\n"    );
+  printf( "there is an error in any of them.\n"                             );
 }
 
 
@@ -43,6 +48,12 @@ int main( int argc, char** argv ) {
   /* output filename */
   char* filename = "coords.txt";
 
+  /* gimbal model filename, for the mission time estimate ("-" for none) */
+  char gimfile[256] = "-";
+
+  /* decimal places in the output, or PREC_EXACT */
+  int prec = PLAN_PREC;
+
   /*allocate start/corner coords */
   point* start     = (point*)malloc(sizeof(point));
   point* top_right = (point*)malloc(sizeof(point)); 
@@ -55,7 +66,7 @@ int main( int argc, char** argv ) {
   
 
   /***** Command line args processing (could also use interactive dialog) ****/
-  if( argc == 13 ) {
+  if( 13 <= argc && argc <= 15 ) {
     sscanf( argv[1],  "%lf", &flength        );
     sscanf( argv[2],  "%lf", &sensw          );
     sscanf( argv[3],  "%lf", &sensh          );
@@ -68,6 +79,8 @@ int main( int argc, char** argv ) {
     sscanf( argv[10], "%lf", &hover          );
     sscanf( argv[11], "%lf", &yover          );
     sscanf( argv[12], "%d",  &opt            );
+    if( argc >= 14 ) sscanf( argv[13], "%255s", gimfile );
+    if( argc == 15 ) sscanf( argv[14], "%d",    &prec   );
   }
 
 
@@ -110,6 +123,15 @@ int main( int argc, char** argv ) {
     puts( "integer for yes.\n"                                              );
     scanf( "%d", &opt );
 
+    puts( "\nWould you like a mission time estimate? Enter the name of a "  );
+    puts( "gimbal model file (see gimbal.txt), or - for no estimate.\n"      );
+    scanf( "%255s", gimfile );
+
+    puts( "\nHow many decimal places for the coordinates? Enter a number "  );
+    printf( "from 0 to %d, or %d for full precision.\n\n", PREC_MAX,
+            PREC_EXACT                                                     );
+    scanf( "%d", &prec );
+
     puts( "\nNote: for future reference, if you would like to skip this "    );
     puts( "dialog and simply enter the command line arguments when calling " );
     puts( "the executable, here is the format for that:\n"                   );
@@ -118,7 +140,7 @@ int main( int argc, char** argv ) {
 
   else {
     fprintf( stderr, "\nIt looks like you had the wrong number of command " );
-    fprintf( stderr, "line args;\nyou should have either none or 12.\n"     );
+    fprintf( stderr, "line args;\nyou should have either none, 12, 13 or 14.\n" );
     usage();
     return -1;
   }
@@ -182,18 +204,41 @@ int main( int argc, char** argv ) {
     ++problem;
   }
 
-  if( hover < -100.0 || 100.0 < hover ) {
+  if( !hoverOk( hover ) ) {
     fprintf( stderr, "\nHorizontal overlap percentage needs to be in range " );
-    fprintf( stderr, "[-100.0,100.0] \n" );
+    fprintf( stderr, "%s \n", HOVER_RANGE );
     ++problem;
   }
 
-  if( yover < -100.0 || 50.0 < yover ) {
+  if( !yoverOk( yover ) ) {
     fprintf( stderr, "\nVertical overlap percentage needs to be in range " );
-    fprintf( stderr, "[-100.0,50.0] \n" );
+    fprintf( stderr, "%s \n", YOVER_RANGE );
+    ++problem;
+  }
+
+  if( prec < PREC_EXACT || PREC_MAX < prec ) {
+    fprintf( stderr, "\nPrecision needs to be %d, or in range [0,%d]\n",
+             PREC_EXACT, PREC_MAX );
     ++problem;
   }
 
+  /* gimbal model, if an estimate was asked for */
+  gimbal gim;
+  estimate* est = NULL;
+
+  if( strcmp( gimfile, "-" ) ) {
+    FILE* gimf = fopen( gimfile, "r" );
+    if( !gimf || readGimbal( gimf, &gim ) ) {
+      fprintf( stderr, "\nCould not read a gimbal model from %s\n", gimfile );
+      ++problem;
+    }
+    else if( !( est = (estimate*)malloc(sizeof(estimate)) ) ) {
+      fprintf( stderr, "\nThere was a problem allocating memory." );
+      return -1;
+    }
+    if( gimf ) fclose( gimf );
+  }
+
   if( problem ) {
     usage();
     fprintf( stderr, "\nThere were %d problems total\n", problem);
@@ -204,96 +249,56 @@ int main( int argc, char** argv ) {
   /********* Start of gigapan loops and coordinate printing *******************/  
   
   FILE* output = fopen( filename, "w" );
+  planw* plan = (planw*)malloc(sizeof(planw));
   
-  if( !output ) {
+  if( !output || !plan ) {
     fprintf( stderr, "\nFailed to open a file for output" );
     return -1;
   }
+
+  planwOpen( plan, output, prec );
   
-  /* allocate current displacement point in gigapan, representing 
-   * how far the pan has moved away from the start point */
-  point* curr = (point*)malloc(sizeof(point)); 
-  
-  if( !curr ) {
+  /* horizontal and vertical fields of view */
+  double HFOV = fov( sensw, flength );
+  double VFOV = fov( sensh, flength ); 
+
+  /* lay out the frames: count them, then fill them in */
+  long nframes = gridPlan( start, top_right, bot_left, HFOV, VFOV, hover,
+                           yover, opt, NULL, 0 );
+  frame* frames = (frame*)malloc(nframes*sizeof(frame));
+
+  if( !frames ) {
     fprintf( stderr, "\nThere was a problem allocating memory." );
     return -1;
   }
-  
-  curr->y = 0.0; curr->p = 0.0;
-  
-  /* direction for yaw increment (goes back & forth on rows).
-   * starts out going right (+1) then alternates (-1)^(row#-1) */
-  double hdir = 1.0;
 
-  /* horizontal and vertical fields of view */
-  double HFOV = fov( sensw, flength );
-  double VFOV = fov( sensh, flength ); 
- 
-  /* yaw incremement - defaults to HFOV w/ overlap factored in, 
-   * optimized using the yawDelta function if optimization is chosen */
-  double ydelta = (1.0 - 0.01*hover)*HFOV;
-  
-  /* pitch incremement for the pan, stays the same throughout.
-   * Simply vertical field of view with overlap factored in.*/ 
-  double pdelta = (1.0 - 0.01*yover)*VFOV;
- 
-  /* Loop for pitches in top half of gigapan. Starts at start point, goes right
-   * and zigzags as the pitch increases until it hits the top edge. */  
-  do {
-    
-    /* if user has chosen to optimize panorama, 
-     * calculate the optimized yaw increment  */
-    if( opt ) ydelta = yawDelta( (curr->p + start->p), HFOV, pdelta, hover );  
-    
-    /* loop for a single row of gigpan  */
-    do  {
-      /* print (start point + current displacement) to output file */
-      printPt( shiftPt( curr, start ), output );
-      /* increment the yaw displacement*/
-      curr->y += hdir*ydelta;
-      /* until the yaw displacement is out of bounds */
-    } while( bot_left->y < curr->y && curr->y < top_right->y ) ;
-    
-    /* change the direction of yaw incremement (to allow alternating rows) */
-    hdir *= -1.0;
-    /* Shift the yaw back to the last one printed */
-    curr->y += hdir*ydelta;
-    /* Increment the pitch displacement */
-    curr->p += pdelta;
-  } while( curr->p < top_right->p ); 
-
-  /* shift the current displacement to just left of the start point,  
-   * to avoid double-printing the start point. Next loop will start here. */
-  curr->p = 0.0;
-  hdir = -1.0;
-  if( opt ) ydelta = yawDelta( start->p, HFOV, pdelta, hover );
-  curr->y = hdir*ydelta;
-
-  /* Loop for pitches in bottom half of gigapan. Starts just left of the start 
-   * point, zigzags as the pitch decreases. All the same comments as above. */
-  do {
-    
-    if( opt ) ydelta = yawDelta( (curr->p + start->p), HFOV, pdelta, hover ); 
-    
-    do {  
-      printPt( shiftPt( curr, start ), output );
-      curr->y += hdir*ydelta;
-    } while( bot_left->y < curr->y && curr->y < top_right->y );
-    
-    hdir *= -1;
-    curr->y += hdir*ydelta;
-    curr->p -= pdelta;
-  } while( bot_left->p < curr->p ); 
-
-  if( fclose(output) ) {
+  gridPlan( start, top_right, bot_left, HFOV, VFOV, hover, yover, opt,
+            frames, nframes );
+
+  if( est ) estStart( est, start );
+
+  long i;
+  for( i = 0; i < nframes; ++i ) {
+    /* print (start point + displacement) to output file */
+    point pt = shiftPt( &frames[i].d, start );
+    planwPt( plan, pt );
+    /* and add the frame to the mission estimate, flagging new rows */
+    if( est )
+      estFrame( est, pt, &gim, !i || frames[i].row != frames[i-1].row );
+  }
+
+  if( planwClose(plan) | fclose(output) ) {
     fprintf( stderr, "\nThere was a problem closing the output file" );
     return -1;
   }
   
   puts( "\nThe program has completed successfully. Check \"coords.txt\"" );
   puts( "in the current directory.\n" );
+
+  if( est ) printEst( est, stdout );
   
-  free(start); free(top_right); free(bot_left); free(curr); 
+  free(est); free(plan);
+  free(start); free(top_right); free(bot_left); free(frames);
 
   return 0;
 }
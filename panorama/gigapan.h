@@ -18,6 +18,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <math.h>
+#include <string.h>
 
 /************Auxiliary functions, constants, structures**************/
 
@@ -48,6 +49,18 @@ double rad2deg = 180.0/pi;
 #define UP_RANGE "[0.0,90.0]"
 #define DOWN_RANGE "[-90.0,0.0]"
 
+/* Overlap percentage ranges for printing convenience. A full 100%
+ * horizontal overlap would never move along a row, so that end is open. */
+#define HOVER_RANGE "[-100.0,100.0)"
+#define YOVER_RANGE "[-100.0,50.0]"
+
+/* int hoverOk( horizontal overlap ), yoverOk( vertical overlap )
+ *
+ * Whether an overlap percentage is in HOVER_RANGE, YOVER_RANGE.
+ */
+int hoverOk( double hover ) { return -100.0 <= hover && hover < 100.0; }
+int yoverOk( double yover ) { return -100.0 <= yover && yover <= 50.0; }
+
 
 /* double fov( focal length, sensor dimension )
  *
@@ -175,4 +188,267 @@ double yawDelta( int pitch, int hfov, int pdelt, double hol ) {
   }
 }  
 
+/************Gigapan frame layout**************/
+
+/* struct for one frame of a gigapan: how far it is from the start point
+ * (add the start with shiftPt() to get where to point), its row, numbered
+ * in shooting order, and its pitch level in whole pitch steps from the
+ * start point, down negative. The top and bottom halves both start a row
+ * at level 0, so two rows share it. */
+typedef struct frame {
+  point d;
+  int row;
+  int level;
+} frame;
+
+/* long gridPlan( start point, top right, bottom left, horizontal and
+ *                vertical fields of view, horizontal and vertical overlap,
+ *                optimize, frame array, array size )
+ *
+ * Lays out the frames of a gigapan in shooting order: from the start
+ * point, zigzagging up row by row to the top edge, then from just left of
+ * the start point zigzagging down to the bottom edge. Stores the first cap
+ * frames and returns how many there are in all, so a call with cap 0
+ * counts them.
+ *
+ * DEPENDS ON SPECIFIC IMU SPHERE PARAMETERIZATION
+ */
+long gridPlan( point* start, point* top_right, point* bot_left, double HFOV,
+               double VFOV, double hover, double yover, int opt, frame* out,
+               long cap ) {
+  /* current displacement in the gigapan, representing how far the pan
+   * has moved away from the start point */
+  point curr = { 0.0, 0.0 };
+  long n = 0;
+  int row = 0, level = 0;
+
+  /* direction for yaw increment (goes back & forth on rows).
+   * starts out going right (+1) then alternates (-1)^(row#-1) */
+  double hdir = 1.0;
+
+  /* yaw incremement - defaults to HFOV w/ overlap factored in,
+   * optimized using the yawDelta function if optimization is chosen */
+  double ydelta = (1.0 - 0.01*hover)*HFOV;
+
+  /* pitch incremement for the pan, stays the same throughout.
+   * Simply vertical field of view with overlap factored in.*/
+  double pdelta = (1.0 - 0.01*yover)*VFOV;
+
+  /* Loop for pitches in top half of gigapan. Starts at start point, goes right
+   * and zigzags as the pitch increases until it hits the top edge. */
+  do {
+
+    /* if user has chosen to optimize panorama,
+     * calculate the optimized yaw increment  */
+    if( opt ) ydelta = yawDelta( (curr.p + start->p), HFOV, pdelta, hover );
+
+    /* loop for a single row of gigpan  */
+    do  {
+      /* record the current displacement */
+      if( n < cap ) { out[n].d = curr; out[n].row = row; out[n].level = level; }
+      ++n;
+      /* increment the yaw displacement*/
+      curr.y += hdir*ydelta;
+      /* until the yaw displacement is out of bounds */
+    } while( bot_left->y < curr.y && curr.y < top_right->y ) ;
+
+    /* change the direction of yaw incremement (to allow alternating rows) */
+    hdir *= -1.0;
+    /* Shift the yaw back to the last one recorded */
+    curr.y += hdir*ydelta;
+    /* Increment the pitch displacement */
+    curr.p += pdelta;
+    ++level;
+    ++row;
+  } while( curr.p < top_right->p );
+
+  /* shift the current displacement to just left of the start point,
+   * to avoid doubling the start point. Next loop will start here. */
+  curr.p = 0.0;
+  level = 0;
+  hdir = -1.0;
+  if( opt ) ydelta = yawDelta( start->p, HFOV, pdelta, hover );
+  curr.y = hdir*ydelta;
+
+  /* Loop for pitches in bottom half of gigapan. Starts just left of the start
+   * point, zigzags as the pitch decreases. All the same comments as above. */
+  do {
+
+    if( opt ) ydelta = yawDelta( (curr.p + start->p), HFOV, pdelta, hover );
+
+    do {
+      if( n < cap ) { out[n].d = curr; out[n].row = row; out[n].level = level; }
+      ++n;
+      curr.y += hdir*ydelta;
+    } while( bot_left->y < curr.y && curr.y < top_right->y );
+
+    hdir *= -1;
+    curr.y += hdir*ydelta;
+    curr.p -= pdelta;
+    --level;
+    ++row;
+  } while( bot_left->p < curr.p );
+
+  return n;
+}
+
+/************Mission time estimation**************/
+
+/* Camera board multishoot never fires faster than this, in seconds: every
+ * 2 s in cameraControlv4 (the "(currTime - lastPicTime) > 2000" check) and
+ * on cameraControlv5's fallback without a fix or height. v5 with a fix
+ * spaces frames by ground overlap instead, only every 30 s while hovering,
+ * so for it the estimate is a lower bound. */
+#define MULTISHOOT_FLOOR 2.0
+
+/* Most rows estimate() will break a mission down into */
+#define MAX_ROWS 512
+
+/* struct describing how fast the gimbal and camera can go. Rates are in
+ * deg/s, accelerations in deg/s^2, times in seconds. settle is how long the
+ * stabilization PID takes to ring down after a move (read it off a step
+ * response), trigger and write are the shutter pulse and the camera's
+ * time to store a frame. multishoot nonzero means frames are taken by the
+ * camera board's multishoot timer rather than one 't' at a time. */
+typedef struct gimbal {
+  double yrate, prate;
+  double yacc, pacc;
+  double settle;
+  double trigger, write;
+  int multishoot;
+} gimbal;
+
+/* struct for one row of a mission estimate */
+typedef struct rowest {
+  double pitch;   /* pitch of the row */
+  int frames;     /* frames taken in the row */
+  double time;    /* seconds from the last frame of the previous row */
+} rowest;
+
+/* struct to accumulate a mission estimate one frame at a time */
+typedef struct estimate {
+  double time;        /* total mission time, seconds */
+  int frames;         /* total frames */
+  int nrows;          /* rows so far (only the first MAX_ROWS are kept) */
+  point last;         /* previous frame */
+  rowest rows[MAX_ROWS];
+} estimate;
+
+
+/* double slewTime( distance, max rate, acceleration )
+ *
+ * Time for one gimbal axis to move the given number of degrees, starting
+ * and ending at rest: a trapezoidal velocity profile, or a triangular one
+ * if the move is too short to reach the max rate.
+ */
+double slewTime( double d, double rate, double acc ) {
+  d = fabs( d );
+  if( d*acc < rate*rate ) return 2.0*sqrt( d/acc );
+  return d/rate + rate/acc;
+}
+
+/* double frameTime( previous point, next point, gimbal model )
+ *
+ * Time from one frame to the next: both axes slew at once, then the
+ * platform settles and the camera fires and stores the frame. Multishoot
+ * can't go faster than its floor, however close the frames are.
+ *
+ * DEPENDS ON SPECIFIC IMU SPHERE PARAMETRIZATION
+ */
+double frameTime( point* a, point* b, gimbal* g ) {
+  /* shortest way around in yaw */
+  double dy = fmod( fabs( b->y - a->y ), 360.0 );
+  if( 180.0 < dy ) dy = 360.0 - dy;
+
+  double ty = slewTime( dy, g->yrate, g->yacc );
+  double tp = slewTime( b->p - a->p, g->prate, g->pacc );
+  double t = ( ty < tp ? tp : ty ) + g->settle + g->trigger + g->write;
+
+  if( g->multishoot && t < MULTISHOOT_FLOOR ) t = MULTISHOOT_FLOOR;
+  return t;
+}
+
+/* void estStart( estimate, start point )
+ *
+ * Resets the estimate for a mission starting with the gimbal at rest,
+ * already pointed at the start point.
+ */
+void estStart( estimate* e, point* start ) {
+  e->time = 0.0; e->frames = 0; e->nrows = 0;
+  e->last = *start;
+}
+
+/* void estFrame( estimate, next frame, gimbal model, new row? )
+ *
+ * Adds one frame of the plan to the estimate. Pass a nonzero newrow with
+ * the first frame of every row. The first frame skips the multishoot
+ * floor: the board times its interval from the last frame it took, which
+ * is long past by the time multishoot is switched on, so it fires at
+ * once. Constant time, no allocation, so it can sit inside planner search
+ * loops.
+ */
+void estFrame( estimate* e, point pt, gimbal* g, int newrow ) {
+  double t = e->frames ? frameTime( &e->last, &pt, g )
+                       : g->settle + g->trigger + g->write;
+
+  if( newrow ) {
+    if( e->nrows < MAX_ROWS ) {
+      e->rows[e->nrows].pitch = pt.p;
+      e->rows[e->nrows].frames = 0;
+      e->rows[e->nrows].time = 0.0;
+    }
+    ++e->nrows;
+  }
+
+  if( 0 < e->nrows && e->nrows <= MAX_ROWS ) {
+    e->rows[e->nrows - 1].frames += 1;
+    e->rows[e->nrows - 1].time += t;
+  }
+
+  e->time += t; ++e->frames;
+  e->last = pt;
+}
+
+/* int readGimbal( gimbal model file, gimbal to fill in )
+ *
+ * Reads a gimbal model: yaw rate, pitch rate, yaw acceleration, pitch
+ * acceleration, settle time, trigger latency, write latency and multishoot
+ * (0 or 1), whitespace separated, in that order.
+ *
+ * Returns 0 if all of them were read and make sense, -1 otherwise.
+ */
+int readGimbal( FILE* in, gimbal* g ) {
+  if( fscanf( in, "%lf %lf %lf %lf %lf %lf %lf %d", &g->yrate, &g->prate,
+              &g->yacc, &g->pacc, &g->settle, &g->trigger, &g->write,
+              &g->multishoot ) != 8 )
+    return -1;
+
+  if( !( 0.0 < g->yrate && 0.0 < g->prate && 0.0 < g->yacc &&
+         0.0 < g->pacc ) || g->settle < 0.0 || g->trigger < 0.0 ||
+      g->write < 0.0 )
+    return -1;
+
+  return 0;
+}
+
+/* void printEst( estimate, output file pointer )
+ *
+ * Prints the predicted mission time, frame rate and per-row breakdown.
+ */
+void printEst( estimate* e, FILE* outf ) {
+  int i;
+
+  fprintf( outf, "\nPredicted mission: %d frames in %.1f s (%.1f min), "
+           "%.1f frames/min\n", e->frames, e->time, e->time/60.0,
+           e->time ? 60.0*e->frames/e->time : 0.0 );
+
+  fprintf( outf, "\nrow\tpitch\tframes\ttime (s)\n" );
+  for( i = 0; i < e->nrows && i < MAX_ROWS; ++i )
+    fprintf( outf, "%d\t%.1f\t%d\t%.1f\n", i + 1, e->rows[i].pitch,
+             e->rows[i].frames, e->rows[i].time );
+
+  if( MAX_ROWS < e->nrows )
+    fprintf( outf, "(%d more rows not shown)\n", e->nrows - MAX_ROWS );
+}
+
 #endif /* GIGAPAN */
@@ -0,0 +1,201 @@
+/**********************************************
+ * UCSD NGS Stabilized Aerial Camera Platform *
+ * Plan Conversion and I/O Benchmark          *
+ *                                            *
+ * File: UCSD-E4E/sacp/panorama/planio.c      *
+ * Requires ./planio.h ./gigapan.h            *
+ **********************************************/
+
+#include <time.h>
+#include "planio.h"
+
+/* Frames in the benchmark plan by default */
+#define BENCH_FRAMES 1000000
+
+/* One frame in this many of the benchmark plan is an edge case */
+#define BENCH_EDGE 1000
+
+/* Numbers no angle would be, which stdio and planio still have to agree on:
+ * the longest possible text at a fixed precision, subnormals, zeros */
+static const double edges[] = { 1e70, -1e300, DBL_MAX, -DBL_MAX, 1e300,
+  4.9e-324, -2.2250738585072009e-308, -0.0, 0.0, 9007199254740993.0,
+  0.05, -0.25, 1e22, 1e-20 };
+#define NEDGES ( sizeof(edges)/sizeof(edges[0]) )
+
+void usage() {
+  puts( "\nplanio copy <plan in> <plan out> <precision>"                     );
+  puts( "planio bench [frames] [precision]\n"                                );
+  puts( "copy:  rewrites a plan with the given number of decimal places, or" );
+  puts( "       -1 for the fewest digits that read back exactly."            );
+  puts( "bench: writes and reads back a plan of frames at full double"       );
+  puts( "       precision (default 1000000) through stdio and through"      );
+  printf( "       planio, at the given precision (default %d: exact), and\n",
+          PREC_EXACT );
+  puts( "       checks both agree."                                          );
+}
+
+double seconds() {
+  struct timespec ts;
+  clock_gettime( CLOCK_MONOTONIC, &ts );
+  return ts.tv_sec + 1e-9*ts.tv_nsec;
+}
+
+
+/* int copy( plan in, plan out, precision ) */
+int copy( const char* inname, const char* outname, int prec ) {
+  FILE* in = fopen( inname, "r" );
+  FILE* out = fopen( outname, "w" );
+  planr* r = (planr*)malloc( sizeof(planr) );
+  planw* w = (planw*)malloc( sizeof(planw) );
+  point x;
+  long n = 0;
+  int got;
+
+  if( !in || !out || !r || !w ) {
+    fprintf( stderr, "\nCould not open %s or %s\n", inname, outname );
+    return -1;
+  }
+
+  planrOpen( r, in );
+  planwOpen( w, out, prec );
+  while( ( got = planrPt( r, &x ) ) == 1 ) { planwPt( w, x ); ++n; }
+
+  if( got < 0 ) fprintf( stderr, "\n%s: not a plan after frame %ld\n",
+                         inname, n );
+  if( planwClose( w ) || fclose( out ) ) {
+    fprintf( stderr, "\nCould not write %s\n", outname );
+    got = -1;
+  }
+
+  fclose( in );
+  free( r ); free( w );
+  return got < 0 ? -1 : 0;
+}
+
+/* void benchLine( what, seconds, frames, bytes ) - one line of results */
+void benchLine( const char* what, double t, long n, long bytes ) {
+  printf( "%-24s %7.3f s %8.2f Mframes/s %8.1f MB/s\n", what, t, 1e-6*n/t,
+          1e-6*bytes/t );
+}
+
+/* int bench( frames, precision )
+ *
+ * The plan is a real gigapan's worth of rows repeated, shifted by a
+ * fraction of a degree each time so every number has all its digits, with
+ * one frame in BENCH_EDGE (from the first) made of edge case numbers.
+ * stdio writes with "%.Nf" (or "%.17g" for exact) and reads with fscanf;
+ * both go to and from a temporary file, which stays in the page cache.
+ */
+int bench( long n, int prec ) {
+  point* pts = (point*)malloc( n*sizeof(point) );
+  point* back = (point*)malloc( n*sizeof(point) );
+  planw* w = (planw*)malloc( sizeof(planw) );
+  planr* r = (planr*)malloc( sizeof(planr) );
+  FILE* a = tmpfile();
+  FILE* b = tmpfile();
+  long i, bad = 0, sizeA, sizeB;
+  char fmt[16];
+
+  if( !pts || !back || !w || !r || !a || !b ) {
+    fprintf( stderr, "\nThere was a problem allocating memory." );
+    return -1;
+  }
+
+  point start = { 12.3, 4.5 };
+  double hfov = fov( 35.0, 36.0 ), vfov = fov( 35.0, 24.0 );
+  for( i = 0; i < n; ++i ) {
+    point curr = { ( i % 23 - 11 )*0.7*hfov + 1e-3*( i/23 ),
+                   ( i/23 % 9 - 4 )*0.7*vfov };
+    pts[i] = shiftPt( &curr, &start );
+  }
+  for( i = 0; i < n; i += BENCH_EDGE ) {
+    pts[i].y = edges[( 2*( i/BENCH_EDGE ) ) % NEDGES];
+    pts[i].p = edges[( 2*( i/BENCH_EDGE ) + 1 ) % NEDGES];
+  }
+
+  if( prec == PREC_EXACT ) strcpy( fmt, "%.17g\t%.17g\n" );
+  else snprintf( fmt, sizeof(fmt), "%%.%df\t%%.%df\n", prec, prec );
+  printf( "%ld frames, stdio \"%.*s\" against planio precision %d\n", n,
+          (int)strlen( fmt ) - 1, fmt, prec );
+
+  /* write */
+  double t = seconds();
+  for( i = 0; i < n; ++i ) fprintf( a, fmt, pts[i].y, pts[i].p );
+  fflush( a );
+  t = seconds() - t;
+  sizeA = ftell( a );
+  benchLine( "stdio fprintf", t, n, sizeA );
+
+  t = seconds();
+  planwOpen( w, b, prec );
+  for( i = 0; i < n; ++i ) planwPt( w, pts[i] );
+  if( planwClose( w ) ) { fprintf( stderr, "\nWrite failed\n" ); return -1; }
+  t = seconds() - t;
+  sizeB = ftell( b );
+  benchLine( "planio write", t, n, sizeB );
+
+  /* read */
+  rewind( a );
+  t = seconds();
+  for( i = 0; i < n; ++i )
+    if( fscanf( a, "%lf %lf", &back[i].y, &back[i].p ) != 2 ) break;
+  t = seconds() - t;
+  benchLine( "stdio fscanf", t, i, sizeA );
+
+  rewind( b );
+  t = seconds();
+  planrOpen( r, b );
+  for( i = 0; i < n; ++i )
+    if( planrPt( r, &back[i] ) != 1 ) break;
+  t = seconds() - t;
+  benchLine( "planio read", t, i, sizeB );
+  if( i < n ) bad = n - i;
+
+  /* check: planio's numbers read back exactly as fscanf reads its text,
+   * and at a fixed precision its text is the same as stdio's */
+  rewind( b );
+  for( i = 0; i < n && !bad; ++i ) {
+    point x;
+    if( fscanf( b, "%lf %lf", &x.y, &x.p ) != 2 ) { bad = n - i; break; }
+    bad += memcmp( &x, &back[i], sizeof(point) ) != 0;
+    if( prec == PREC_EXACT )
+      bad += memcmp( &x, &pts[i], sizeof(point) ) != 0;
+  }
+  if( prec != PREC_EXACT ) {
+    char ba[4096], bb[4096];
+    size_t ga, gb;
+    rewind( a ); rewind( b );
+    bad += sizeA != sizeB;
+    do {
+      ga = fread( ba, 1, sizeof(ba), a );
+      gb = fread( bb, 1, sizeof(bb), b );
+      bad += ga != gb || memcmp( ba, bb, ga );
+    } while( ga && !bad );
+  }
+
+  printf( "%.1f bytes/frame (stdio %.1f), %ld mismatches\n",
+          (double)sizeB/n, (double)sizeA/n, bad );
+
+  fclose( a ); fclose( b );
+  free( pts ); free( back ); free( w ); free( r );
+  return bad ? -1 : 0;
+}
+
+
+int main( int argc, char** argv ) {
+  if( argc == 5 && !strcmp( argv[1], "copy" ) ) {
+    int prec = atoi( argv[4] );
+    if( PREC_EXACT <= prec && prec <= PREC_MAX )
+      return copy( argv[2], argv[3], prec );
+  }
+
+  if( 2 <= argc && argc <= 4 && !strcmp( argv[1], "bench" ) ) {
+    long n = argc < 3 ? BENCH_FRAMES : atol( argv[2] );
+    int prec = argc < 4 ? PREC_EXACT : atoi( argv[3] );
+    if( 0 < n && PREC_EXACT <= prec && prec <= PREC_MAX )
+      return bench( n, prec );
+  }
+
+  usage();
+  return -1;
+}
@@ -0,0 +1,421 @@
+#ifndef PLANIO
+#define PLANIO
+
+/**********************************************
+ * UCSD E4E Stabilized Aerial Camera Platform *
+ * Panorama                                   *
+ *                                            *
+ * File: UCSD-E4E/sacp/panorama/planio.h      *
+ *                                            *
+ * Compatibility: C99 (exact fast paths need  *
+ *                a compiler with __int128)   *
+ **********************************************/
+
+#include <stdint.h>
+#include <float.h>
+#include "gigapan.h"
+
+/* Plan text is one frame per line, yaw<tab>pitch<newline>, the format
+ * printPt() writes. A planw writes it and a planr reads it through its own
+ * buffer, with no stdio formatting or scanning and no allocation per
+ * frame; the structs themselves hold the buffers.
+ *
+ * Numbers are written either to a fixed number of decimal places, rounded
+ * exactly like printf's "%.Nf" (so precision 1 is byte for byte what
+ * printPt() writes), or with PREC_EXACT in the fewest digits that read
+ * back as the same double. Numbers read are correctly rounded, like
+ * strtod(), so an exact plan round trips bit for bit.
+ *
+ * Plan coordinates are degrees, so the fast paths only cover magnitudes
+ * up to 2^53 with up to 20 decimals (plenty for any angle); anything else
+ * goes through snprintf()/strtod() and gives the same text or value. */
+
+/* Bytes buffered by each reader and writer */
+#define PLANIO_BUF 32768
+
+/* Precision for the shortest text that reads back exactly */
+#define PREC_EXACT -1
+
+/* Decimal places gigapan writes coords.txt with unless told otherwise
+ * (what printPt() always did) */
+#define PLAN_PREC 1
+
+/* Most decimal places a writer will print */
+#define PREC_MAX 20
+
+/* Longest number written, and longest number a reader accepts, counting
+ * the terminating NUL: room for any double to PREC_MAX places (a sign,
+ * DBL_MAX_10_EXP + 1 digits, the point and the decimals) */
+#define NUM_MAX ( DBL_MAX_10_EXP + PREC_MAX + 5 )
+
+/* struct for a plan writer */
+typedef struct planw {
+  FILE*  out;
+  int    prec;    /* decimal places, or PREC_EXACT */
+  int    err;     /* set once a write fails */
+  size_t len;
+  char   buf[PLANIO_BUF];
+} planw;
+
+/* struct for a plan reader */
+typedef struct planr {
+  FILE*  in;
+  size_t pos, len;
+  int    eof;
+  char   buf[PLANIO_BUF];
+} planr;
+
+
+/* Two digit strings, for writing digits in pairs */
+static const char digitPairs[] =
+  "00010203040506070809101112131415161718192021222324252627282930313233343536"
+  "37383940414243444546474849505152535455565758596061626364656667686970717273"
+  "7475767778798081828384858687888990919293949596979899";
+
+/* int fmtDigits( number, digits after the point, output )
+ *
+ * Writes q/10^d in plain decimal, with at least one digit before the point.
+ * Returns the length.
+ */
+int fmtDigits( uint64_t q, int d, char* s ) {
+  char tmp[48];
+  int n = 0, len = 0;
+
+  /* digits, last first */
+  while( q >= 100 ) {
+    const char* p = &digitPairs[2*( q % 100 )];
+    q /= 100;
+    tmp[n++] = p[1]; tmp[n++] = p[0];
+  }
+  if( q >= 10 ) { tmp[n++] = digitPairs[2*q+1]; tmp[n++] = digitPairs[2*q]; }
+  else tmp[n++] = '0' + q;
+
+  /* zeros between the point and the first digit */
+  while( n <= d ) tmp[n++] = '0';
+
+  while( n ) {
+    if( n == d ) s[len++] = '.';
+    s[len++] = tmp[--n];
+  }
+  return len;
+}
+
+/* Powers of ten that fit in 64 bits */
+static const uint64_t pow10u[] = { 1ull, 10ull, 100ull, 1000ull, 10000ull,
+  100000ull, 1000000ull, 10000000ull, 100000000ull, 1000000000ull,
+  10000000000ull, 100000000000ull, 1000000000000ull, 10000000000000ull,
+  100000000000000ull, 1000000000000000ull, 10000000000000000ull,
+  100000000000000000ull, 1000000000000000000ull, 10000000000000000000ull };
+
+/* int fmtSlow( number, precision, output ) - fmtNum() by way of snprintf
+ *
+ * Returns the bytes actually written, never more than NUM_MAX - 1, however
+ * long snprintf() says the whole text would have been.
+ */
+int fmtSlow( double x, int prec, char* s ) {
+  int p, n;
+
+  if( prec != PREC_EXACT ) n = snprintf( s, NUM_MAX, "%.*f", prec, x );
+  else {
+    for( p = 1; p < 17; ++p ) {
+      n = snprintf( s, NUM_MAX, "%.*g", p, x );
+      if( strtod( s, NULL ) == x ) break;
+    }
+    if( p == 17 ) n = snprintf( s, NUM_MAX, "%.17g", x );
+  }
+  return n < 0 ? 0 : NUM_MAX <= n ? NUM_MAX - 1 : n;
+}
+
+/* int fmtNum( number, precision, output buffer of NUM_MAX bytes )
+ *
+ * Writes x to prec decimal places, or with PREC_EXACT in the fewest
+ * decimal places that read back as exactly x. Returns the length.
+ *
+ * x is f*2^-k for a 53 bit integer f. Its value to d places is the
+ * integer nearest f*10^d/2^k, which 128 bit integers give exactly with
+ * only shifts; the text reads back as x if it is within half a unit in
+ * the last place of x (a quarter below, when x is a power of two). If d
+ * places read back so do d+1, so the fewest is found by bisection.
+ */
+int fmtNum( double x, int prec, char* s ) {
+#ifdef __SIZEOF_INT128__
+  typedef unsigned __int128 u128;
+  uint64_t bits;
+  memcpy( &bits, &x, sizeof(bits) );
+
+  int bexp = ( bits >> 52 ) & 0x7ff;
+  uint64_t f = bits & ( ( (uint64_t)1 << 52 ) - 1 );
+  int k = 1075 - bexp;
+  int neg = bits >> 63;
+
+  if( !bexp || bexp == 0x7ff || k < 0 || 126 < k || PREC_MAX < prec )
+    return fmtSlow( x, prec, s );
+  f |= (uint64_t)1 << 52;
+
+  u128 fd, q, err;
+  u128 half = k ? (u128)1 << ( k - 1 ) : 0;
+  u128 mask = ( (u128)1 << k ) - 1;
+  int d, len = 0;
+
+  if( prec == PREC_EXACT ) {
+    /* lower neighbour is closer when f is a power of two */
+    int tight = f == (uint64_t)1 << 52 && 1 < bexp;
+    int lo = 0, hi = PREC_MAX + 1;
+    uint64_t best = 0;
+
+    /* fewest places in [lo,hi) that read back; hi if none */
+    while( lo < hi ) {
+      d = ( lo + hi )/2;
+      u128 p10 = d < 20 ? (u128)pow10u[d] : (u128)pow10u[19]*10;
+      fd = (u128)f*p10;
+      q = ( fd + half ) >> k;
+      if( ( q << k ) >= fd ) err = 2*( ( q << k ) - fd );
+      else err = ( tight ? 4 : 2 )*( fd - ( q << k ) );
+
+      if( err < p10 || ( err == p10 && !( f & 1 ) ) ) {
+        hi = d;
+        best = (uint64_t)q;
+        if( q >> 64 ) return fmtSlow( x, prec, s );
+      }
+      else lo = d + 1;
+    }
+    if( PREC_MAX < lo ) return fmtSlow( x, prec, s );
+    d = lo;
+    q = best;
+  }
+  else {
+    d = prec;
+    fd = (u128)f*( d < 20 ? (u128)pow10u[d] : (u128)pow10u[19]*10 );
+    q = fd >> k;
+    /* round half to even, like printf */
+    u128 rem = fd & mask;
+    if( k && ( half < rem || ( rem == half && ( q & 1 ) ) ) ) ++q;
+    if( q >> 64 ) return fmtSlow( x, prec, s );
+  }
+
+  if( neg ) s[len++] = '-';
+  return len + fmtDigits( (uint64_t)q, d, s + len );
+#else
+  return fmtSlow( x, prec, s );
+#endif
+}
+
+
+/* int parseSlow( token, length, value ) - parseNum() by way of strtod */
+int parseSlow( const char* s, size_t n, double* v ) {
+  char tmp[NUM_MAX + 1];
+  char* end;
+
+  if( !n || NUM_MAX < n ) return -1;
+  memcpy( tmp, s, n ); tmp[n] = '\0';
+  *v = strtod( tmp, &end );
+  return end == tmp + n ? 0 : -1;
+}
+
+/* int parseNum( token, length, value )
+ *
+ * Reads a whole token as a number, correctly rounded. Plain decimals of
+ * up to 19 significant digits take a fast path: small mantissas and
+ * powers of ten are exact in doubles, and otherwise the mantissa over the
+ * power of ten is divided out in 128 bit integers with enough bits left
+ * to round the quotient once. Everything else (longer mantissas, huge
+ * exponents, hex floats, inf, nan...) goes to strtod(), so a token is a
+ * number exactly when strtod() reads all of it.
+ *
+ * Returns 0, or -1 if the token isn't a number.
+ */
+int parseNum( const char* s, size_t n, double* v ) {
+  static const double p10[] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8,
+    1e9, 1e10, 1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20,
+    1e21, 1e22 };
+  const char* c = s;
+  const char* end = s + n;
+  uint64_t w = 0;
+  int neg = 0, digits = 0, any = 0, e10 = 0;
+
+  if( c < end && ( *c == '-' || *c == '+' ) ) neg = *c++ == '-';
+
+  for( ; c < end && '0' <= *c && *c <= '9'; ++c, any = 1 ) {
+    if( digits || *c != '0' ) {
+      if( ++digits > 19 ) return parseSlow( s, n, v );
+      w = 10*w + ( *c - '0' );
+    }
+  }
+  if( c < end && *c == '.' ) {
+    for( ++c; c < end && '0' <= *c && *c <= '9'; ++c, any = 1 ) {
+      if( digits || *c != '0' ) {
+        if( ++digits > 19 ) return parseSlow( s, n, v );
+        w = 10*w + ( *c - '0' );
+      }
+      --e10;
+    }
+  }
+  if( !any ) return parseSlow( s, n, v );
+
+  if( c < end && ( *c == 'e' || *c == 'E' ) ) {
+    int eneg = 0, x = 0;
+    if( ++c < end && ( *c == '-' || *c == '+' ) ) eneg = *c++ == '-';
+    if( c == end ) return parseSlow( s, n, v );
+    for( ; c < end && '0' <= *c && *c <= '9'; ++c )
+      if( ( x = 10*x + ( *c - '0' ) ) > 9999 ) return parseSlow( s, n, v );
+    e10 += eneg ? -x : x;
+  }
+  if( c != end ) return parseSlow( s, n, v );
+
+  if( !w ) { *v = neg ? -0.0 : 0.0; return 0; }
+
+  /* mantissa and power of ten both exact in a double */
+  if( !( w >> 53 ) && -22 <= e10 && e10 <= 22 ) {
+    *v = e10 < 0 ? (double)w/p10[-e10] : (double)w*p10[e10];
+    if( neg ) *v = -*v;
+    return 0;
+  }
+
+#ifdef __SIZEOF_INT128__
+  /* w/10^-e10, with w shifted up as far as it goes; 10^21 < 2^70 leaves
+   * the quotient over 56 bits */
+  if( -21 <= e10 && e10 < 0 ) {
+    typedef unsigned __int128 u128;
+    u128 den = 1;
+    int i, sh = __builtin_clzll( w ) + 64 - 1;
+
+    for( i = 0; i < -e10; ++i ) den *= 10;
+    u128 num = (u128)w << sh;
+    u128 q = num/den;
+    int sticky = num - q*den != 0;
+
+    int bits = q >> 64 ? 128 - __builtin_clzll( (uint64_t)( q >> 64 ) )
+                  : 64 - __builtin_clzll( (uint64_t)q );
+    int drop = bits - 53;
+    uint64_t mant = (uint64_t)( q >> drop );
+    u128 rest = q & ( ( (u128)1 << drop ) - 1 );
+    u128 halfway = (u128)1 << ( drop - 1 );
+
+    if( halfway < rest || ( rest == halfway && ( sticky || ( mant & 1 ) ) ) )
+      ++mant;
+    if( mant >> 53 ) { mant >>= 1; ++drop; }
+
+    *v = ldexp( (double)mant, drop - sh );
+    if( neg ) *v = -*v;
+    return 0;
+  }
+#endif
+
+  return parseSlow( s, n, v );
+}
+
+
+/* void planwOpen( writer, output file, precision )
+ *
+ * Starts a writer on an open file; precision is decimal places (0 to
+ * PREC_MAX) or PREC_EXACT.
+ */
+void planwOpen( planw* w, FILE* out, int prec ) {
+  w->out = out;
+  w->prec = prec;
+  w->err = 0;
+  w->len = 0;
+}
+
+/* int planwFlush( writer ) - writes out the buffer; returns 0 or -1 */
+int planwFlush( planw* w ) {
+  if( w->len && fwrite( w->buf, 1, w->len, w->out ) != w->len ) w->err = 1;
+  w->len = 0;
+  return w->err ? -1 : 0;
+}
+
+/* void planwPt( writer, point ) - buffers one yaw<tab>pitch<newline> line
+ *
+ * Each number takes under NUM_MAX bytes, so after the flush the line
+ * always fits and len never passes the end of buf.
+ */
+void planwPt( planw* w, point x ) {
+  if( sizeof(w->buf) - w->len < 2*NUM_MAX + 2 ) planwFlush( w );
+
+  char* s = w->buf + w->len;
+  int n = fmtNum( x.y, w->prec, s );
+  s[n++] = '\t';
+  n += fmtNum( x.p, w->prec, s + n );
+  s[n++] = '\n';
+  w->len += n;
+}
+
+/* int planwClose( writer )
+ *
+ * Flushes the writer, and the file under it. Closing the file is up to
+ * the caller. Returns 0, or -1 if anything failed to write.
+ */
+int planwClose( planw* w ) {
+  if( planwFlush( w ) || fflush( w->out ) ) return -1;
+  return 0;
+}
+
+
+/* int planSpace( character ) - whitespace between numbers */
+int planSpace( char c ) {
+  return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\v' ||
+         c == '\f';
+}
+
+/* void planrOpen( reader, input file ) - starts a reader on an open file */
+void planrOpen( planr* r, FILE* in ) {
+  r->in = in;
+  r->pos = r->len = 0;
+  r->eof = 0;
+}
+
+/* int planrToken( reader, token start, token length )
+ *
+ * Skips whitespace and finds the next token, refilling the buffer so a
+ * whole token (up to NUM_MAX bytes) is always in it. Returns 1, 0 at the
+ * end of the input, or -1 if the token is too long or reading failed.
+ */
+int planrToken( planr* r, const char** tok, size_t* n ) {
+  size_t i;
+
+  for( ;; ) {
+    while( r->pos < r->len && planSpace( r->buf[r->pos] ) )
+      ++r->pos;
+
+    /* all of the token, plus the byte after it, in the buffer */
+    for( i = r->pos; i < r->len && !planSpace( r->buf[i] ); ++i )
+      ;
+    if( i < r->len || ( r->eof && r->pos < r->len ) ) {
+      if( NUM_MAX < i - r->pos ) return -1;
+      *tok = r->buf + r->pos;
+      *n = i - r->pos;
+      r->pos = i;
+      return 1;
+    }
+    if( r->eof ) return 0;
+    if( r->pos == 0 && r->len == sizeof(r->buf) ) return -1;
+
+    /* keep the partial token, read more after it */
+    memmove( r->buf, r->buf + r->pos, r->len - r->pos );
+    r->len -= r->pos;
+    r->pos = 0;
+    size_t got = fread( r->buf + r->len, 1, sizeof(r->buf) - r->len, r->in );
+    if( !got && ferror( r->in ) ) return -1;
+    if( !got ) r->eof = 1;
+    r->len += got;
+  }
+}
+
+/* int planrPt( reader, point to fill in )
+ *
+ * Reads the next yaw and pitch. Any whitespace separates numbers, as with
+ * fscanf( "%lf %lf" ). Returns 1, 0 at the end of the plan, or -1 if the
+ * plan has something other than pairs of numbers in it.
+ */
+int planrPt( planr* r, point* x ) {
+  const char* tok;
+  size_t n;
+  int got = planrToken( r, &tok, &n );
+
+  if( got <= 0 ) return got;
+  if( parseNum( tok, n, &x->y ) ) return -1;
+  if( planrToken( r, &tok, &n ) != 1 || parseNum( tok, n, &x->p ) ) return -1;
+  return 1;
+}
+
+#endif